@@ -1,30 +1,67 @@
 #pragma once
+#include "connection.hpp"
 #include "http_client.hpp"
+#include "io_service_pool.hpp"
 
 namespace cinatra {
 class client_factory {
 public:
   static client_factory &instance() {
-    static client_factory instance;
+    static client_factory instance(pool_size());
     return instance;
   }
 
+  // number of io_services(one thread each) used by the factory, must be set
+  // before the first call of instance(), default is 1
+  static void set_pool_size(std::size_t size) { pool_size() = size; }
+
+  // clients are spread over the pool round-robin
   template <typename... Args> auto new_client(Args &&...args) {
-    return std::make_shared<http_client>(ios_, std::forward<Args>(args)...);
+    return std::make_shared<http_client>(pool_.get_io_service(),
+                                         std::forward<Args>(args)...);
   }
 
-  void run() { ios_.run(); }
+  // pin the client to the index-th io_service of the pool
+  template <typename... Args>
+  auto new_client_at(std::size_t index, Args &&...args) {
+    return std::make_shared<http_client>(pool_.get_io_service(index),
+                                         std::forward<Args>(args)...);
+  }
 
-  void stop() { ios_.stop(); }
+  // co-locate the client with a server connection, the client runs on the
+  // connection's io thread, so a handler calling a backend needs no
+  // cross-thread hop
+  template <typename SocketType, typename... Args>
+  auto new_client_on(const std::shared_ptr<connection<SocketType>> &conn,
+                     Args &&...args) {
+    return std::make_shared<http_client>(conn->get_io_service(),
+                                         std::forward<Args>(args)...);
+  }
+
+  std::size_t size() const { return pool_.size(); }
+
+  // block until stop() is called
+  void run() {
+    if (thd_->joinable())
+      thd_->join();
+  }
+
+  void stop() { pool_.stop(); }
 
 private:
-  client_factory() : work_(ios_) {
-    thd_ = std::make_shared<std::thread>([this] { ios_.run(); });
+  explicit client_factory(std::size_t pool_size) : pool_(pool_size) {
+    thd_ = std::make_shared<std::thread>([this] { pool_.run(); });
   }
 
   ~client_factory() {
-    ios_.stop();
-    thd_->join();
+    pool_.stop();
+    if (thd_->joinable())
+      thd_->join();
+  }
+
+  static std::size_t &pool_size() {
+    static std::size_t size = 1;
+    return size;
   }
 
   client_factory(const client_factory &) = delete;
@@ -32,8 +69,7 @@ private:
   client_factory(client_factory &&) = delete;
   client_factory &operator=(client_factory &&) = delete;
 
-  boost::asio::io_service ios_;
-  boost::asio::io_service::work work_;
+  io_service_pool pool_;
   std::shared_ptr<std::thread> thd_;
 };
 
@@ -1,6 +1,8 @@
 #pragma once
 #include "define.h"
+#include "http2_session.hpp"
 #include "http_cache.hpp"
+#include "io_service_pool.hpp"
 #include "request.hpp"
 #include "response.hpp"
 #include "use_asio.hpp"
@@ -21,6 +23,9 @@ public:
   virtual ~base_connection() {}
 };
 
+template <typename SocketType> class connection_stream;
+template <typename SocketType> class connection_sse;
+
 struct ssl_configure {
   std::string cert_file;
   std::string key_file;
@@ -36,7 +41,8 @@ public:
       std::size_t max_req_size, long keep_alive_timeout, http_handler &handler,
       std::string &static_dir,
       std::function<bool(request &req, response &res)> *upload_check)
-      : socket_(io_service), MAX_REQ_SIZE_(max_req_size),
+      : io_service_(io_service), socket_(io_service),
+        MAX_REQ_SIZE_(max_req_size),
         KEEP_ALIVE_TIMEOUT_(keep_alive_timeout), timer_(io_service),
         http_handler_(handler), req_(res_), static_dir_(static_dir),
         upload_check_(upload_check) {
@@ -45,6 +51,13 @@ public:
     }
 
     init_multipart_parser();
+    res_.set_stream_factory([this](std::string head, size_t window) {
+      return std::make_shared<connection_stream<SocketType>>(
+          this->shared_from_this(), std::move(head), window);
+    });
+    res_.set_sse_starter([this](sse_topic &topic, std::string head) {
+      start_sse(topic, std::move(head));
+    });
   }
 
   void init_ssl_context(ssl_configure ssl_conf) {
@@ -56,6 +69,8 @@ public:
       boost::asio::ssl::context ssl_context(boost::asio::ssl::context::sslv23);
       ssl_context.set_options(ssl_options);
       ssl_context.set_password_callback([](auto, auto) { return "123456"; });
+      SSL_CTX_set_alpn_select_cb(ssl_context.native_handle(), select_alpn,
+                                 &http2_enabled_);
 
       std::error_code ec;
       if (fs::exists(ssl_conf.cert_file, ec)) {
@@ -76,8 +91,38 @@ public:
 #endif
   }
 
+#ifdef CINATRA_ENABLE_SSL
+  // picks h2 when the server has HTTP/2 enabled and the client offers it
+  static int select_alpn(::SSL *, const unsigned char **out,
+                         unsigned char *outlen, const unsigned char *in,
+                         unsigned int inlen, void *http2_enabled) {
+    auto find = [&](std::string_view protocol) {
+      for (unsigned int i = 0; i < inlen; i += 1 + in[i]) {
+        std::string_view offered((const char *)in + i + 1,
+                                 std::min<unsigned int>(in[i], inlen - i - 1));
+        if (offered == protocol) {
+          *out = in + i + 1;
+          *outlen = in[i];
+          return true;
+        }
+      }
+      return false;
+    };
+
+    if (*static_cast<bool *>(http2_enabled) && find("h2"))
+      return SSL_TLSEXT_ERR_OK;
+    if (find("http/1.1"))
+      return SSL_TLSEXT_ERR_OK;
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+#endif
+
   auto &tcp_socket() { return socket_; }
 
+  // the io_service this connection runs on, clients created on it avoid
+  // cross-thread hops, see client_factory::new_client_on
+  boost::asio::io_service &get_io_service() { return io_service_; }
+
   auto &socket() {
     if constexpr (is_ssl_) {
 #ifdef CINATRA_ENABLE_SSL
@@ -152,14 +197,22 @@ public:
   }
 
   void reset_timer() {
-    if (!enable_timeout_)
+    if (!enable_timeout_ && sse_ == nullptr)
       return;
 
-    timer_.expires_from_now(std::chrono::seconds(KEEP_ALIVE_TIMEOUT_));
+    // an event stream is not timed out, it gets keep-alive comments instead
+    timer_.expires_from_now(sse_ ? sse_->keep_alive()
+                                 : std::chrono::seconds(KEEP_ALIVE_TIMEOUT_));
     auto self = this->shared_from_this();
 
     timer_.async_wait([self](boost::system::error_code const &ec) {
-      if (ec) {
+      if (ec || self->has_closed_) {
+        return;
+      }
+
+      if (self->sse_) {
+        self->sse_->tick();
+        self->reset_timer();
         return;
       }
 
@@ -177,6 +230,10 @@ public:
 
   void enable_timeout(bool enable) { enable_timeout_ = enable; }
 
+  void enable_http2(bool enable) { http2_enabled_ = enable; }
+
+  void set_load_token(load_token token) { load_token_ = std::move(token); }
+
   void set_tag(std::any &&tag) { tag_ = std::move(tag); }
 
   auto &get_tag() { return tag_; }
@@ -299,6 +356,10 @@ public:
   //	close();
   //}
 private:
+  template <typename> friend class http2_session;
+  template <typename> friend class connection_stream;
+  template <typename> friend class connection_sse;
+
   void do_read() {
     reset();
 
@@ -375,6 +436,18 @@ private:
       return;
     }
 
+    if (http2_enabled_ && len_ == 0) {
+      std::string_view received(req_.data(), req_.current_size());
+      if (received.starts_with(http2::client_preface)) {
+        start_http2(received);
+        return;
+      }
+      if (http2::client_preface.starts_with(received)) {
+        do_read_head();
+        return;
+      }
+    }
+
     int ret = req_.parse_header(len_);
 
     if (ret == parse_status::has_error) {
@@ -405,6 +478,14 @@ private:
     }
   }
 
+  // the rest of the connection is HTTP/2, served by a session that keeps the
+  // connection alive
+  void start_http2(std::string_view received) {
+    auto session = std::make_shared<http2_session<SocketType>>(
+        this->shared_from_this(), http_handler_, MAX_REQ_SIZE_);
+    session->start(received);
+  }
+
   void handle_request(std::size_t bytes_transferred) {
     if (req_.has_body()) {
       auto type = get_content_type();
@@ -1267,6 +1348,36 @@ private:
     return true;
   }
 
+  // the response became an event stream, the connection serves it until the
+  // client goes away
+  void start_sse(sse_topic &topic, std::string head) {
+    std::optional<uint64_t> last_event_id;
+    auto last = req_.get_header_value("last-event-id");
+    uint64_t id;
+    auto [ptr, ec] =
+        std::from_chars(last.data(), last.data() + last.size(), id);
+    if (ec == std::errc{} && ptr == last.data() + last.size())
+      last_event_id = id;
+
+    sse_ = std::make_shared<connection_sse<SocketType>>(
+        this->shared_from_this(), topic.max_queued_bytes(), topic.keep_alive());
+    sse_->send(std::make_shared<const std::string>(std::move(head)));
+    topic.subscribe(sse_, last_event_id);
+    sse_->watch_close();
+    reset_timer();
+  }
+
+  // a streamed response is done, the connection goes on as if it had
+  // written the response itself
+  void finish_stream(bool ok) {
+    if (!ok) {
+      close();
+      return;
+    }
+
+    handle_write(boost::system::error_code{});
+  }
+
   void response_back(status_type status, std::string &&content) {
     res_.set_status_and_content(status, std::move(content));
     do_write(); // response to client
@@ -1366,6 +1477,7 @@ private:
   static constexpr bool is_ssl_ = std::is_same_v<SocketType, SSL>;
 
   //-----------------send message----------------//
+  boost::asio::io_service &io_service_;
   boost::asio::ip::tcp::socket socket_;
 #ifdef CINATRA_ENABLE_SSL
   std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket &>>
@@ -1373,6 +1485,8 @@ private:
 #endif
   boost::asio::steady_timer timer_;
   bool enable_timeout_ = true;
+  bool http2_enabled_ = false;
+  std::shared_ptr<connection_sse<SocketType>> sse_;
   response res_;
   request req_;
   websocket ws_;
@@ -1402,12 +1516,175 @@ private:
   const http_handler &http_handler_;
   std::function<bool(request &req, response &res)> *upload_check_ = nullptr;
   std::any tag_;
+  load_token load_token_ = nullptr;
   std::function<void(request &, std::string &)> multipart_begin_ = nullptr;
 
   size_t len_ = 0;
   size_t last_transfer_ = 0;
 };
 
+template <typename SocketType>
+class connection_stream final : public response_stream {
+public:
+  connection_stream(std::shared_ptr<connection<SocketType>> conn,
+                    std::string head, size_t window)
+      : response_stream(conn->get_io_service(), std::move(head), window),
+        conn_(std::move(conn)) {}
+
+private:
+  void write(const std::vector<boost::asio::const_buffer> &buffers) override {
+    conn_->reset_timer();
+    boost::asio::async_write(
+        conn_->socket(), buffers,
+        [this, self = shared_from_this()](const boost::system::error_code &ec,
+                                          std::size_t) { on_written(ec); });
+  }
+
+  void finish(bool ok) override { conn_->finish_stream(ok); }
+
+  std::shared_ptr<connection<SocketType>> conn_;
+};
+
+// The sending side of an event stream. Events come in from any thread as
+// shared buffers and are queued on the connection's thread, only the
+// pointers are copied per client.
+template <typename SocketType>
+class connection_sse final : public sse_subscriber {
+public:
+  connection_sse(std::shared_ptr<connection<SocketType>> conn,
+                 size_t max_queued_bytes, std::chrono::seconds keep_alive)
+      : conn_(conn), io_service_(conn->get_io_service()),
+        max_queued_bytes_(max_queued_bytes), keep_alive_(keep_alive) {}
+
+  void deliver(std::shared_ptr<const std::string> chunk) override {
+    boost::asio::post(io_service_, [this, self = shared_from_this(),
+                                    chunk = std::move(chunk)]() mutable {
+      send(std::move(chunk));
+    });
+  }
+
+  void replay(std::vector<std::shared_ptr<const std::string>> chunks) override {
+    boost::asio::post(io_service_, [this, self = shared_from_this(),
+                                    chunks = std::move(chunks)]() mutable {
+      auto conn = conn_.lock();
+      if (conn == nullptr || conn->has_close())
+        return;
+
+      active_ = true;
+      replay_ = std::move(chunks);
+      replay_pos_ = 0;
+      if (writing_.empty())
+        write_queued(std::move(conn));
+    });
+  }
+
+  void send(std::shared_ptr<const std::string> chunk) {
+    auto conn = conn_.lock();
+    if (conn == nullptr || conn->has_close())
+      return;
+
+    queued_bytes_ += chunk->size();
+    if (queued_bytes_ > max_queued_bytes_) {
+      // too slow to keep up, it reconnects and resumes from the topic's ring
+      drop(*conn);
+      return;
+    }
+
+    active_ = true;
+    queued_.push_back(std::move(chunk));
+    if (writing_.empty())
+      write_queued(std::move(conn));
+  }
+
+  // a comment if nothing was sent since the last tick
+  void tick() {
+    static const auto comment = std::make_shared<const std::string>(
+        format_chunk(":\n\n"));
+    if (!active_)
+      send(comment);
+    active_ = false;
+  }
+
+  // a client sends nothing on an event stream, the read completes when it
+  // goes away; until then it keeps the connection alive
+  void watch_close() {
+    auto conn = conn_.lock();
+    conn->socket().async_read_some(
+        boost::asio::buffer(read_buf_),
+        [conn, self = shared_from_this()](const boost::system::error_code &,
+                                          std::size_t) { drop(*conn); });
+  }
+
+  std::chrono::seconds keep_alive() const { return keep_alive_; }
+
+private:
+  // the keep-alive timer holds the connection too
+  static void drop(connection<SocketType> &conn) {
+    boost::system::error_code ec;
+    conn.timer_.cancel(ec);
+    conn.close();
+  }
+
+  static std::string format_chunk(std::string_view data) {
+    std::string chunk = to_hex_string(data.size());
+    chunk.append("\r\n").append(data).append("\r\n");
+    return chunk;
+  }
+
+  // a replay goes first, a batch at a time: its events came before the live
+  // ones and are shared with the topic's ring, so they are not counted as
+  // queued
+  void write_queued(std::shared_ptr<connection<SocketType>> conn) {
+    size_t live_bytes = 0;
+    if (replay_pos_ < replay_.size()) {
+      for (size_t size = 0;
+           replay_pos_ < replay_.size() && size < replay_batch;) {
+        size += replay_[replay_pos_]->size();
+        writing_.push_back(std::move(replay_[replay_pos_++]));
+      }
+      if (replay_pos_ == replay_.size())
+        replay_ = {};
+    } else {
+      std::swap(writing_, queued_);
+      for (auto &chunk : writing_)
+        live_bytes += chunk->size();
+    }
+
+    buffers_.clear();
+    for (auto &chunk : writing_)
+      buffers_.push_back(boost::asio::buffer(*chunk));
+    boost::asio::async_write(
+        conn->socket(), buffers_,
+        [this, self = shared_from_this(), conn,
+         live_bytes](const boost::system::error_code &ec, std::size_t) {
+          writing_.clear();
+          queued_bytes_ -= live_bytes;
+          if (ec) {
+            drop(*conn);
+            return;
+          }
+
+          if (replay_pos_ < replay_.size() || !queued_.empty())
+            write_queued(std::move(conn));
+        });
+  }
+
+  std::weak_ptr<connection<SocketType>> conn_;
+  boost::asio::io_service &io_service_;
+  const size_t max_queued_bytes_;
+  const std::chrono::seconds keep_alive_;
+  size_t queued_bytes_ = 0;
+  bool active_ = false;
+  // vectors, not deques: an idle stream allocates nothing for its queue
+  std::vector<std::shared_ptr<const std::string>> queued_;
+  std::vector<std::shared_ptr<const std::string>> writing_;
+  std::vector<boost::asio::const_buffer> buffers_;
+  static constexpr size_t replay_batch = 64 * 1024;
+  std::vector<std::shared_ptr<const std::string>> replay_;
+  size_t replay_pos_ = 0;
+  char read_buf_[16];
+};
+
 inline constexpr data_proc_state ws_open = data_proc_state::data_begin;
 inline constexpr data_proc_state ws_message = data_proc_state::data_continue;
 inline constexpr data_proc_state ws_close = data_proc_state::data_close;
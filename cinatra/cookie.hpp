@@ -1,5 +1,7 @@
 #pragma once
 #include "utils.hpp"
+#include <charconv>
+#include <ctime>
 #include <string>
 
 namespace cinatra {
@@ -36,67 +38,87 @@ public:
   std::string to_string() const {
     std::string result;
     result.reserve(256);
-    result.append(name_);
-    result.append("=");
+    append_to(result);
+    return result;
+  }
+
+  // writes the Set-Cookie value straight into out, e.g. the response buffer
+  void append_to(std::string &out) const {
+    out.append(name_);
+    out.append("=");
     if (version_ == 0) {
       // Netscape cookie
-      result.append(value_);
+      out.append(value_);
       if (!path_.empty()) {
-        result.append("; path=");
-        result.append(path_);
+        out.append("; path=");
+        out.append(path_);
       }
       if (!priority_.empty()) {
-        result.append("; Priority=");
-        result.append(priority_);
+        out.append("; Priority=");
+        out.append(priority_);
       }
       if (max_age_ != -1) {
-        result.append("; expires=");
-        result.append(get_gmt_time_str(max_age_));
+        out.append("; expires=");
+        append_gmt_time(out, max_age_);
       }
       if (secure_) {
-        result.append("; secure");
+        out.append("; secure");
       }
       if (http_only_) {
-        result.append("; HttpOnly");
+        out.append("; HttpOnly");
       }
     } else {
       // RFC 2109 cookie
-      result.append("\"");
-      result.append(value_);
-      result.append("\"");
+      out.append("\"");
+      out.append(value_);
+      out.append("\"");
       if (!comment_.empty()) {
-        result.append("; Comment=\"");
-        result.append(comment_);
-        result.append("\"");
+        out.append("; Comment=\"");
+        out.append(comment_);
+        out.append("\"");
       }
       if (!path_.empty()) {
-        result.append("; Path=\"");
-        result.append(path_);
-        result.append("\"");
+        out.append("; Path=\"");
+        out.append(path_);
+        out.append("\"");
       }
       if (!priority_.empty()) {
-        result.append("; Priority=\"");
-        result.append(priority_);
-        result.append("\"");
+        out.append("; Priority=\"");
+        out.append(priority_);
+        out.append("\"");
       }
 
       if (max_age_ != -1) {
-        result.append("; Max-Age=\"");
-        result.append(std::to_string(max_age_));
-        result.append("\"");
+        char buf[24];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), max_age_);
+        out.append("; Max-Age=\"");
+        out.append(buf, end);
+        out.append("\"");
       }
       if (secure_) {
-        result.append("; secure");
+        out.append("; secure");
       }
       if (http_only_) {
-        result.append("; HttpOnly");
+        out.append("; HttpOnly");
       }
-      result.append("; Version=\"1\"");
+      out.append("; Version=\"1\"");
     }
-    return result;
   }
 
 private:
+  // same format as get_gmt_time_str()
+  static void append_gmt_time(std::string &out, std::time_t t) {
+    std::tm tm{};
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char buf[64];
+    size_t n = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S %Z", &tm);
+    out.append(buf, n);
+  }
+
   int version_ = 0;
   std::string name_ = "";
   std::string value_ = "";
@@ -0,0 +1,197 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace cinatra {
+namespace detail {
+inline constexpr std::string_view known_header_names[] = {
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "content-encoding",
+    "transfer-encoding",
+    "cookie",
+    "range",
+    "upgrade",
+    "sec-websocket-key",
+    "sec-websocket-protocol",
+    "sec-websocket-version",
+    "accept",
+    "accept-encoding",
+    "user-agent",
+    "authorization",
+    "origin",
+    "expect",
+    "if-none-match",
+    "if-modified-since",
+    "referer",
+    "x-forwarded-for",
+};
+
+inline constexpr uint8_t no_header = 0xff;
+inline constexpr size_t known_header_table_size = 64;
+
+constexpr char header_lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+}
+
+constexpr bool header_equal(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (header_lower(a[i]) != header_lower(b[i]))
+      return false;
+  }
+  return true;
+}
+
+// case insensitive FNV-1a
+constexpr size_t header_hash(std::string_view s) {
+  uint32_t h = 2166136261u;
+  for (char c : s) {
+    h ^= (uint8_t)header_lower(c);
+    h *= 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+// looks at the length and three characters only, the seed is searched at
+// compile time so that the known names land in distinct slots
+constexpr size_t known_header_hash(std::string_view s, uint32_t seed) {
+  uint32_t h = (uint32_t)s.size() * seed;
+  h += (uint8_t)header_lower(s[0]) * 31u;
+  h += (uint8_t)header_lower(s[s.size() / 2]) * (seed >> 8);
+  h += (uint8_t)header_lower(s[s.size() - 1]);
+  return (h ^ (h >> 7)) & (known_header_table_size - 1);
+}
+
+constexpr uint32_t find_known_header_seed() {
+  for (uint32_t seed = 1; seed < (1u << 16); seed++) {
+    std::array<bool, known_header_table_size> used{};
+    bool ok = true;
+    for (auto name : known_header_names) {
+      auto slot = known_header_hash(name, seed);
+      if (used[slot]) {
+        ok = false;
+        break;
+      }
+      used[slot] = true;
+    }
+    if (ok)
+      return seed;
+  }
+  return 0;
+}
+
+inline constexpr uint32_t known_header_seed = find_known_header_seed();
+static_assert(known_header_seed != 0,
+              "no perfect hash for the known header names");
+
+inline constexpr auto known_header_slots = [] {
+  std::array<uint8_t, known_header_table_size> slots{};
+  slots.fill(no_header);
+  for (size_t i = 0; i < std::size(known_header_names); i++)
+    slots[known_header_hash(known_header_names[i], known_header_seed)] =
+        (uint8_t)i;
+  return slots;
+}();
+
+inline constexpr size_t min_known_header_size = [] {
+  size_t n = known_header_names[0].size();
+  for (auto name : known_header_names)
+    n = name.size() < n ? name.size() : n;
+  return n;
+}();
+
+inline constexpr size_t max_known_header_size = [] {
+  size_t n = 0;
+  for (auto name : known_header_names)
+    n = name.size() > n ? name.size() : n;
+  return n;
+}();
+
+constexpr int known_header_id(std::string_view name) {
+  if (name.size() < min_known_header_size ||
+      name.size() > max_known_header_size)
+    return -1;
+  uint8_t id = known_header_slots[known_header_hash(name, known_header_seed)];
+  if (id == no_header || !header_equal(known_header_names[id], name))
+    return -1;
+  return id;
+}
+} // namespace detail
+
+// Finds request headers by name in O(1). It is built once per request after
+// parsing: the headers cinatra itself looks at get fixed slots picked by a
+// perfect hash over their lowercase names, any other name goes into a small
+// open addressing table keyed by a case insensitive hash. Both hold positions
+// into the parsed header array, so building allocates nothing. A repeated
+// name resolves to its first occurrence, like the linear scan did.
+class header_index {
+public:
+  static constexpr size_t known_count = std::size(detail::known_header_names);
+
+  header_index() { clear(); }
+
+  // name_of(i) returns the name of header i, for i < count
+  template <typename NameOf> void build(size_t count, NameOf &&name_of) {
+    clear();
+    count_ = count;
+    for (size_t i = 0; i < count && i < max_indexed; i++) {
+      std::string_view name = name_of(i);
+      if (int id = detail::known_header_id(name); id >= 0) {
+        if (known_[id] == empty)
+          known_[id] = (uint8_t)i;
+        continue;
+      }
+
+      size_t slot = detail::header_hash(name) & (table_size - 1);
+      while (others_[slot] != empty &&
+             !detail::header_equal(name_of(others_[slot]), name))
+        slot = (slot + 1) & (table_size - 1);
+      if (others_[slot] == empty)
+        others_[slot] = (uint8_t)i;
+    }
+  }
+
+  void clear() {
+    known_.fill(empty);
+    others_.fill(empty);
+    count_ = 0;
+  }
+
+  // the position of the first header called name, or -1
+  template <typename NameOf>
+  int find(std::string_view name, NameOf &&name_of) const {
+    if (int id = detail::known_header_id(name); id >= 0) {
+      if (known_[id] != empty)
+        return known_[id];
+    } else {
+      size_t slot = detail::header_hash(name) & (table_size - 1);
+      for (; others_[slot] != empty; slot = (slot + 1) & (table_size - 1)) {
+        if (detail::header_equal(name_of(others_[slot]), name))
+          return others_[slot];
+      }
+    }
+
+    // more headers than are indexed, the rest of any name are only scanned
+    for (size_t i = max_indexed; i < count_; i++) {
+      if (detail::header_equal(name_of(i), name))
+        return (int)i;
+    }
+    return -1;
+  }
+
+private:
+  static constexpr uint8_t empty = detail::no_header;
+  static constexpr size_t table_size = 64;
+  // keeps the table at most 3/4 full, a request carries 32 headers at most
+  static constexpr size_t max_indexed = 48;
+
+  std::array<uint8_t, known_count> known_{};
+  std::array<uint8_t, table_size> others_{};
+  size_t count_ = 0;
+};
+} // namespace cinatra
@@ -0,0 +1,436 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// HPACK, the header compression of HTTP/2 (RFC 7541)
+namespace cinatra {
+namespace hpack {
+using header_field = std::pair<std::string_view, std::string_view>;
+
+// index 1 is static_table[0]
+inline constexpr header_field static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// code lengths of the canonical huffman code, symbol 256 is EOS
+inline constexpr uint8_t huffman_code_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+inline constexpr size_t static_table_size = std::size(static_table);
+
+namespace detail {
+// the code is canonical: codes of one length are consecutive and follow
+// symbol order, so the lengths are all it takes to rebuild it
+struct huffman_table {
+  uint32_t code[257] = {};
+  uint16_t sorted[257] = {}; // symbols ordered by code
+  uint32_t first[32] = {};   // the first code of each length
+  uint16_t offset[32] = {};  // where that length starts in sorted
+  uint16_t count[32] = {};
+};
+
+constexpr huffman_table make_huffman_table() {
+  huffman_table t{};
+  uint16_t n = 0;
+  uint32_t code = 0;
+  for (int len = 1; len < 32; len++) {
+    t.first[len] = code;
+    t.offset[len] = n;
+    for (int sym = 0; sym < 257; sym++) {
+      if (huffman_code_lengths[sym] == len) {
+        t.code[sym] = code++;
+        t.sorted[n++] = (uint16_t)sym;
+        t.count[len]++;
+      }
+    }
+    code <<= 1;
+  }
+  return t;
+}
+
+inline constexpr huffman_table huffman = make_huffman_table();
+} // namespace detail
+
+inline size_t huffman_encoded_size(std::string_view str) {
+  size_t bits = 0;
+  for (unsigned char c : str)
+    bits += huffman_code_lengths[c];
+  return (bits + 7) / 8;
+}
+
+inline void huffman_encode(std::string_view str, std::string &out) {
+  uint64_t bits = 0;
+  int count = 0;
+  for (unsigned char c : str) {
+    bits = bits << huffman_code_lengths[c] | detail::huffman.code[c];
+    count += huffman_code_lengths[c];
+    while (count >= 8) {
+      count -= 8;
+      out.push_back((char)(bits >> count));
+    }
+  }
+  // padded with the most significant bits of EOS, all ones
+  if (count > 0)
+    out.push_back((char)(bits << (8 - count) | (0xff >> count)));
+}
+
+// false if the input is not a valid encoding: it contains EOS, or is
+// padded with more than 7 bits or with anything but ones
+inline bool huffman_decode(std::string_view in, std::string &out) {
+  const auto &t = detail::huffman;
+  uint32_t code = 0;
+  int len = 0;
+  for (unsigned char c : in) {
+    for (int bit = 7; bit >= 0; bit--) {
+      code = code << 1 | ((c >> bit) & 1);
+      len++;
+      uint32_t index = code - t.first[len];
+      if (code >= t.first[len] && index < t.count[len]) {
+        uint16_t sym = t.sorted[t.offset[len] + index];
+        if (sym == 256)
+          return false;
+        out.push_back((char)sym);
+        code = 0;
+        len = 0;
+      } else if (len == 30) {
+        return false;
+      }
+    }
+  }
+  return len < 8 && code == (1u << len) - 1;
+}
+
+// an integer with an n bit prefix, first holds the bits above the prefix
+inline void encode_integer(std::string &out, uint8_t first, int prefix_bits,
+                           uint64_t value) {
+  uint64_t max = (1u << prefix_bits) - 1;
+  if (value < max) {
+    out.push_back((char)(first | value));
+    return;
+  }
+
+  out.push_back((char)(first | max));
+  value -= max;
+  while (value >= 128) {
+    out.push_back((char)(value % 128 + 128));
+    value /= 128;
+  }
+  out.push_back((char)value);
+}
+
+inline bool decode_integer(const uint8_t *&p, const uint8_t *end,
+                           int prefix_bits, uint64_t &value) {
+  if (p == end)
+    return false;
+
+  uint64_t max = (1u << prefix_bits) - 1;
+  value = *p++ & max;
+  if (value < max)
+    return true;
+
+  for (int shift = 0; p != end && shift <= 56; shift += 7) {
+    uint8_t b = *p++;
+    value += uint64_t(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// a string literal, huffman coded when that is shorter
+inline void encode_string(std::string &out, std::string_view str) {
+  size_t huffman_size = huffman_encoded_size(str);
+  if (huffman_size < str.size()) {
+    encode_integer(out, 0x80, 7, huffman_size);
+    huffman_encode(str, out);
+  } else {
+    encode_integer(out, 0, 7, str.size());
+    out.append(str);
+  }
+}
+
+inline bool decode_string(const uint8_t *&p, const uint8_t *end,
+                          std::string &out) {
+  if (p == end)
+    return false;
+
+  bool huffman = *p & 0x80;
+  uint64_t size;
+  if (!decode_integer(p, end, 7, size) || size > uint64_t(end - p))
+    return false;
+
+  std::string_view str((const char *)p, size);
+  p += size;
+  out.clear();
+  if (!huffman) {
+    out.assign(str);
+    return true;
+  }
+  return huffman_decode(str, out);
+}
+
+// the dynamic table, newest entry first
+class dynamic_table {
+public:
+  explicit dynamic_table(size_t max_size) : max_size_(max_size) {}
+
+  size_t count() const { return entries_.size(); }
+
+  size_t max_size() const { return max_size_; }
+
+  const std::pair<std::string, std::string> &operator[](size_t i) const {
+    return entries_[i];
+  }
+
+  void set_max_size(size_t max_size) {
+    max_size_ = max_size;
+    evict(0);
+  }
+
+  void add(std::string_view name, std::string_view value) {
+    size_t size = entry_size(name, value);
+    if (size > max_size_) {
+      // an entry larger than the table empties it
+      entries_.clear();
+      size_ = 0;
+      return;
+    }
+
+    evict(size);
+    entries_.emplace_front(name, value);
+    size_ += size;
+  }
+
+  static size_t entry_size(std::string_view name, std::string_view value) {
+    return 32 + name.size() + value.size();
+  }
+
+private:
+  void evict(size_t room) {
+    while (!entries_.empty() && size_ + room > max_size_) {
+      size_ -= entry_size(entries_.back().first, entries_.back().second);
+      entries_.pop_back();
+    }
+  }
+
+  std::deque<std::pair<std::string, std::string>> entries_;
+  size_t size_ = 0;
+  size_t max_size_;
+};
+
+class decoder {
+public:
+  // max_table_size is our SETTINGS_HEADER_TABLE_SIZE
+  explicit decoder(size_t max_table_size = 4096)
+      : table_(max_table_size), max_table_size_(max_table_size) {}
+
+  // calls on_header(name, value) for every field of a header block; false on
+  // a malformed block, which is a COMPRESSION_ERROR for the whole connection
+  template <typename F> bool decode(std::string_view block, F &&on_header) {
+    auto p = (const uint8_t *)block.data();
+    auto end = p + block.size();
+    bool block_start = true;
+    while (p != end) {
+      uint8_t b = *p;
+      if (b & 0x80) {
+        // indexed field
+        uint64_t index;
+        if (!decode_integer(p, end, 7, index) || !lookup(index, name_, value_))
+          return false;
+        on_header(std::string_view(name_), std::string_view(value_));
+      } else if ((b & 0xe0) == 0x20) {
+        // table size update, only at the start of a block
+        uint64_t size;
+        if (!block_start || !decode_integer(p, end, 5, size) ||
+            size > max_table_size_)
+          return false;
+        table_.set_max_size(size);
+        continue;
+      } else {
+        // literal: with incremental indexing, without indexing, never indexed
+        bool indexing = (b & 0xc0) == 0x40;
+        uint64_t index;
+        if (!decode_integer(p, end, indexing ? 6 : 4, index))
+          return false;
+        if (index == 0) {
+          if (!decode_string(p, end, name_))
+            return false;
+        } else if (!lookup(index, name_, value_)) {
+          return false;
+        }
+        if (!decode_string(p, end, value_))
+          return false;
+        if (indexing)
+          table_.add(name_, value_);
+        on_header(std::string_view(name_), std::string_view(value_));
+      }
+      block_start = false;
+    }
+    return true;
+  }
+
+private:
+  bool lookup(uint64_t index, std::string &name, std::string &value) const {
+    if (index == 0)
+      return false;
+    if (index <= static_table_size) {
+      name.assign(static_table[index - 1].first);
+      value.assign(static_table[index - 1].second);
+      return true;
+    }
+    index -= static_table_size + 1;
+    if (index >= table_.count())
+      return false;
+    name.assign(table_[index].first);
+    value.assign(table_[index].second);
+    return true;
+  }
+
+  dynamic_table table_;
+  size_t max_table_size_;
+  std::string name_;
+  std::string value_;
+};
+
+class encoder {
+public:
+  // the peer's SETTINGS_HEADER_TABLE_SIZE, we never use more than 4096
+  void set_max_table_size(size_t size) {
+    size = size < 4096 ? size : 4096;
+    if (size != table_.max_size()) {
+      table_.set_max_size(size);
+      size_update_ = true;
+    }
+  }
+
+  // starts a header block
+  void begin(std::string &out) {
+    if (size_update_) {
+      encode_integer(out, 0x20, 5, table_.max_size());
+      size_update_ = false;
+    }
+  }
+
+  // name must be lowercase; fields that change with every response should
+  // not be indexed, they would only push useful entries out of the table
+  void encode(std::string &out, std::string_view name, std::string_view value,
+              bool indexing = true) {
+    size_t name_index = 0;
+    for (size_t i = 0; i < static_table_size; i++) {
+      if (static_table[i].first != name)
+        continue;
+      if (static_table[i].second == value) {
+        encode_integer(out, 0x80, 7, i + 1);
+        return;
+      }
+      if (name_index == 0)
+        name_index = i + 1;
+    }
+    for (size_t i = 0; i < table_.count(); i++) {
+      if (table_[i].first != name)
+        continue;
+      if (table_[i].second == value) {
+        encode_integer(out, 0x80, 7, static_table_size + 1 + i);
+        return;
+      }
+      if (name_index == 0)
+        name_index = static_table_size + 1 + i;
+    }
+
+    indexing = indexing && dynamic_table::entry_size(name, value) <=
+                               table_.max_size() / 2;
+    encode_integer(out, indexing ? 0x40 : 0, indexing ? 6 : 4, name_index);
+    if (name_index == 0)
+      encode_string(out, name);
+    encode_string(out, value);
+    if (indexing)
+      table_.add(name, value);
+  }
+
+private:
+  dynamic_table table_{4096};
+  bool size_update_ = false;
+};
+} // namespace hpack
+} // namespace cinatra
@@ -0,0 +1,932 @@
+#pragma once
+#include "header_index.hpp"
+#include "hpack.hpp"
+#include "picohttpparser.h"
+#include "request.hpp"
+#include "response.hpp"
+#include "use_asio.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cinatra {
+namespace http2 {
+inline constexpr std::string_view client_preface =
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+enum class frame_type : uint8_t {
+  data = 0,
+  headers = 1,
+  priority = 2,
+  rst_stream = 3,
+  settings = 4,
+  push_promise = 5,
+  ping = 6,
+  goaway = 7,
+  window_update = 8,
+  continuation = 9,
+};
+
+inline constexpr uint8_t flag_end_stream = 0x1;
+inline constexpr uint8_t flag_ack = 0x1;
+inline constexpr uint8_t flag_end_headers = 0x4;
+inline constexpr uint8_t flag_padded = 0x8;
+inline constexpr uint8_t flag_priority = 0x20;
+
+enum class settings_id : uint16_t {
+  header_table_size = 1,
+  enable_push = 2,
+  max_concurrent_streams = 3,
+  initial_window_size = 4,
+  max_frame_size = 5,
+  max_header_list_size = 6,
+};
+
+enum error_code : uint32_t {
+  no_error = 0,
+  protocol_error = 1,
+  internal_error = 2,
+  flow_control_error = 3,
+  stream_closed = 5,
+  frame_size_error = 6,
+  refused_stream = 7,
+  cancel = 8,
+  compression_error = 9,
+  enhance_your_calm = 11,
+};
+
+inline constexpr size_t frame_header_size = 9;
+inline constexpr uint32_t default_window_size = 65535;
+inline constexpr int64_t max_window_size = 0x7fffffff;
+inline constexpr uint32_t default_max_frame_size = 16384;
+inline constexpr uint32_t max_concurrent_streams = 100;
+// what we let a peer send on one stream and on the connection before it has
+// to wait for a WINDOW_UPDATE
+inline constexpr uint32_t stream_window_size = 1 << 20;
+inline constexpr uint32_t connection_window_size = 1 << 24;
+inline constexpr size_t max_header_list_size = 64 * 1024;
+// above this many bytes waiting to be written, response bodies wait and the
+// peer is not read from (it may be flooding us with PINGs it doesn't read
+// the answers to)
+inline constexpr size_t max_queued_output = 256 * 1024;
+
+inline uint32_t read_u32(const char *p) {
+  auto b = (const uint8_t *)p;
+  return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 |
+         b[3];
+}
+
+inline void append_u32(std::string &out, uint32_t n) {
+  char b[4] = {(char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n};
+  out.append(b, 4);
+}
+
+// lowercase token characters; ':' only leads the pseudo-header names
+inline bool valid_field(std::string_view name, std::string_view value) {
+  if (name.empty())
+    return false;
+  for (size_t i = 0; i < name.size(); i++) {
+    unsigned char c = name[i];
+    if (c <= 0x20 || c >= 0x7f || (c >= 'A' && c <= 'Z') ||
+        (c == ':' && i > 0))
+      return false;
+  }
+  return value.find_first_of(std::string_view("\0\r\n", 3)) ==
+         std::string_view::npos;
+}
+
+// HTTP/1.1 connection management headers, which HTTP/2 does not carry
+inline bool is_connection_header(std::string_view name) {
+  return iequal(name.data(), name.size(), "connection") ||
+         iequal(name.data(), name.size(), "keep-alive") ||
+         iequal(name.data(), name.size(), "proxy-connection") ||
+         iequal(name.data(), name.size(), "transfer-encoding") ||
+         iequal(name.data(), name.size(), "upgrade");
+}
+} // namespace http2
+
+template <typename SocketType> class connection;
+
+// Serves an HTTP/2 connection, taken over from a connection whose first bytes
+// were the client preface (h2c with prior knowledge, or h2 picked by ALPN).
+// Every stream is handed to the same http_handler as an HTTP/1.1 request: the
+// header block is turned into a request head and parsed by the request as
+// usual, and the HTTP/1.1 response the handler builds is turned back into a
+// HEADERS frame and DATA frames. Handlers run synchronously on the io_service
+// of the connection, so one request and one response serve all streams. A
+// file body (response::set_status_and_file) is read a frame at a time as the
+// flow control windows open. Streams that need the connection itself
+// (delayed and chunked responses, multipart uploads, websocket) are not
+// supported.
+template <typename SocketType>
+class http2_session
+    : public std::enable_shared_from_this<http2_session<SocketType>>,
+      private noncopyable {
+public:
+  http2_session(std::shared_ptr<connection<SocketType>> conn,
+                const std::function<void(request &, response &)> &handler,
+                size_t max_body_size)
+      : conn_(std::move(conn)), http_handler_(handler),
+        max_body_size_(max_body_size) {
+    read_buf_.resize(16 * 1024);
+  }
+
+  // received holds what was read so far, starting with the client preface
+  void start(std::string_view received) {
+    char settings[18];
+    size_t n = 0;
+    auto add_setting = [&](http2::settings_id id, uint32_t value) {
+      settings[n++] = 0;
+      settings[n++] = (char)id;
+      for (int shift = 24; shift >= 0; shift -= 8)
+        settings[n++] = (char)(value >> shift);
+    };
+    add_setting(http2::settings_id::max_concurrent_streams,
+                http2::max_concurrent_streams);
+    add_setting(http2::settings_id::initial_window_size,
+                http2::stream_window_size);
+    add_setting(http2::settings_id::max_header_list_size,
+                http2::max_header_list_size);
+    write_frame_header(n, http2::frame_type::settings, 0, 0);
+    out_.append(settings, n);
+    write_window_update(0, http2::connection_window_size -
+                               http2::default_window_size);
+    recv_window_ = http2::connection_window_size;
+
+    in_.assign(received);
+    handle_input();
+  }
+
+private:
+  struct stream {
+    std::string head; // the request line and headers in HTTP/1.1 form
+    std::string body;
+    int64_t content_length = -1;
+    int64_t send_window = 0;
+    int64_t recv_window = 0;
+    uint32_t recv_consumed = 0;
+    bool request_done = false; // END_STREAM received
+    bool head_request = false;
+    // the part of the response body that waits for flow control window
+    std::string pending;
+    size_t pending_pos = 0;
+    // or the file it is still to be read from
+    std::shared_ptr<std::ifstream> file;
+    uint64_t file_left = 0;
+  };
+
+  void do_read() {
+    conn_->reset_timer();
+    conn_->socket().async_read_some(
+        boost::asio::buffer(read_buf_.data(), read_buf_.size()),
+        [this, self = this->shared_from_this()](
+            const boost::system::error_code &ec, std::size_t size) {
+          if (ec) {
+            conn_->close();
+            return;
+          }
+
+          in_.append(read_buf_.data(), size);
+          handle_input();
+        });
+  }
+
+  void handle_input() {
+    bool ok = process();
+    flush();
+    if (!ok)
+      return;
+
+    if (out_.size() + write_buf_.size() > http2::max_queued_output)
+      read_paused_ = true; // until flush() has written enough
+    else
+      do_read();
+  }
+
+  // handles the complete frames in in_, false after a connection error
+  bool process() {
+    size_t pos = 0;
+    if (!preface_received_) {
+      if (in_.size() < http2::client_preface.size())
+        return true;
+      if (!std::string_view(in_).starts_with(http2::client_preface)) {
+        connection_error(http2::protocol_error);
+        return false;
+      }
+      pos = http2::client_preface.size();
+      preface_received_ = true;
+    }
+
+    bool ok = true;
+    while (in_.size() - pos >= http2::frame_header_size) {
+      auto h = (const uint8_t *)in_.data() + pos;
+      uint32_t length = uint32_t(h[0]) << 16 | uint32_t(h[1]) << 8 | h[2];
+      auto type = (http2::frame_type)h[3];
+      uint8_t flags = h[4];
+      uint32_t stream_id = http2::read_u32((const char *)h + 5) & 0x7fffffff;
+      if (length > http2::default_max_frame_size) {
+        connection_error(http2::frame_size_error);
+        ok = false;
+        break;
+      }
+      if (in_.size() - pos - http2::frame_header_size < length)
+        break;
+
+      std::string_view payload(in_.data() + pos + http2::frame_header_size,
+                               length);
+      pos += http2::frame_header_size + length;
+      if (!on_frame(type, flags, stream_id, payload)) {
+        ok = false;
+        break;
+      }
+    }
+
+    in_.erase(0, pos);
+    return ok;
+  }
+
+  bool on_frame(http2::frame_type type, uint8_t flags, uint32_t stream_id,
+                std::string_view payload) {
+    using http2::frame_type;
+    if (!settings_received_ && type != frame_type::settings)
+      return connection_error(http2::protocol_error);
+    // a header block must not be interleaved with any other frame
+    if (continuation_stream_ != 0 && type != frame_type::continuation)
+      return connection_error(http2::protocol_error);
+
+    switch (type) {
+    case frame_type::data:
+      return on_data(flags, stream_id, payload);
+    case frame_type::headers:
+      return on_headers(flags, stream_id, payload);
+    case frame_type::continuation:
+      if (stream_id == 0 || stream_id != continuation_stream_)
+        return connection_error(http2::protocol_error);
+      return on_header_fragment(flags, payload);
+    case frame_type::priority:
+      if (stream_id == 0)
+        return connection_error(http2::protocol_error);
+      if (payload.size() != 5)
+        reset_stream(stream_id, http2::frame_size_error);
+      return true;
+    case frame_type::rst_stream:
+      if (stream_id == 0 || stream_id > last_stream_id_)
+        return connection_error(http2::protocol_error);
+      if (payload.size() != 4)
+        return connection_error(http2::frame_size_error);
+      streams_.erase(stream_id);
+      return true;
+    case frame_type::settings:
+      return on_settings(flags, stream_id, payload);
+    case frame_type::push_promise:
+      // only servers push
+      return connection_error(http2::protocol_error);
+    case frame_type::ping:
+      if (stream_id != 0)
+        return connection_error(http2::protocol_error);
+      if (payload.size() != 8)
+        return connection_error(http2::frame_size_error);
+      if (!(flags & http2::flag_ack)) {
+        write_frame_header(8, frame_type::ping, http2::flag_ack, 0);
+        out_.append(payload);
+      }
+      return true;
+    case frame_type::goaway:
+      // the peer closes the connection once its streams are done
+      if (stream_id != 0)
+        return connection_error(http2::protocol_error);
+      return true;
+    case frame_type::window_update:
+      return on_window_update(stream_id, payload);
+    default:
+      // unknown frame types are ignored
+      return true;
+    }
+  }
+
+  // strips the padding of a DATA or HEADERS frame
+  static bool unpad(uint8_t flags, std::string_view &payload) {
+    if (!(flags & http2::flag_padded))
+      return true;
+    if (payload.empty())
+      return false;
+    size_t pad = (uint8_t)payload[0];
+    if (pad >= payload.size())
+      return false;
+    payload = payload.substr(1, payload.size() - 1 - pad);
+    return true;
+  }
+
+  bool on_data(uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    if (stream_id == 0 || stream_id > last_stream_id_)
+      return connection_error(http2::protocol_error);
+
+    // padding counts against the windows too
+    uint32_t size = (uint32_t)payload.size();
+    recv_window_ -= size;
+    if (recv_window_ < 0)
+      return connection_error(http2::flow_control_error);
+    recv_consumed_ += size;
+    if (recv_consumed_ >= http2::connection_window_size / 2) {
+      write_window_update(0, recv_consumed_);
+      recv_window_ += recv_consumed_;
+      recv_consumed_ = 0;
+    }
+
+    if (!unpad(flags, payload))
+      return connection_error(http2::protocol_error);
+
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+      // a stream we reset or finished, its data is dropped
+      return true;
+    }
+
+    stream &s = it->second;
+    if (s.request_done) {
+      reset_stream(stream_id, http2::stream_closed);
+      return true;
+    }
+
+    s.recv_window -= size;
+    if (s.recv_window < 0) {
+      reset_stream(stream_id, http2::flow_control_error);
+      return true;
+    }
+    if (s.body.size() + payload.size() > max_body_size_) {
+      reset_stream(stream_id, http2::enhance_your_calm);
+      return true;
+    }
+    s.body.append(payload);
+
+    if (flags & http2::flag_end_stream) {
+      s.request_done = true;
+      dispatch(stream_id, s);
+      return true;
+    }
+
+    s.recv_consumed += size;
+    if (s.recv_consumed >= http2::stream_window_size / 2) {
+      write_window_update(stream_id, s.recv_consumed);
+      s.recv_window += s.recv_consumed;
+      s.recv_consumed = 0;
+    }
+    return true;
+  }
+
+  bool on_headers(uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    if (stream_id == 0 || stream_id % 2 == 0)
+      return connection_error(http2::protocol_error);
+    if (!unpad(flags, payload))
+      return connection_error(http2::protocol_error);
+    if (flags & http2::flag_priority) {
+      if (payload.size() < 5)
+        return connection_error(http2::frame_size_error);
+      payload.remove_prefix(5);
+    }
+
+    if (stream_id <= last_stream_id_) {
+      // trailers of a request still sending its body
+      auto it = streams_.find(stream_id);
+      if (it == streams_.end() || it->second.request_done)
+        return connection_error(http2::stream_closed);
+      if (!(flags & http2::flag_end_stream))
+        return connection_error(http2::protocol_error);
+    }
+
+    continuation_stream_ = stream_id;
+    continuation_end_stream_ = flags & http2::flag_end_stream;
+    header_block_.clear();
+    return on_header_fragment(flags, payload);
+  }
+
+  bool on_header_fragment(uint8_t flags, std::string_view fragment) {
+    if (header_block_.size() + fragment.size() > http2::max_header_list_size)
+      return connection_error(http2::enhance_your_calm);
+    header_block_.append(fragment);
+    if (!(flags & http2::flag_end_headers))
+      return true;
+
+    uint32_t stream_id = continuation_stream_;
+    continuation_stream_ = 0;
+    return on_header_block(stream_id, continuation_end_stream_);
+  }
+
+  bool on_header_block(uint32_t stream_id, bool end_stream) {
+    bool trailers = stream_id <= last_stream_id_;
+    bool valid = true;
+    bool regular_seen = false;
+    size_t list_size = 0;
+    int64_t content_length = -1;
+    method_.clear();
+    path_.clear();
+    scheme_.clear();
+    authority_.clear();
+    host_.clear();
+    fields_.clear();
+    cookie_.clear();
+
+    // the whole block is decoded even if the stream is refused, the dynamic
+    // table has to stay in step with the peer's
+    bool decoded = decoder_.decode(
+        header_block_, [&](std::string_view name, std::string_view value) {
+          list_size += hpack::dynamic_table::entry_size(name, value);
+          if (!valid || list_size > http2::max_header_list_size ||
+              !http2::valid_field(name, value)) {
+            valid = false;
+            return;
+          }
+
+          if (name[0] == ':') {
+            std::string *target = name == ":method"      ? &method_
+                                  : name == ":path"      ? &path_
+                                  : name == ":scheme"    ? &scheme_
+                                  : name == ":authority" ? &authority_
+                                                         : nullptr;
+            if (regular_seen || trailers || target == nullptr ||
+                !target->empty()) {
+              valid = false;
+              return;
+            }
+            target->assign(value);
+            return;
+          }
+
+          regular_seen = true;
+          if (trailers)
+            return;
+          if (http2::is_connection_header(name) ||
+              (name == "te" && value != "trailers")) {
+            valid = false;
+          } else if (name == "cookie") {
+            // sent as separate fields to compress better
+            if (!cookie_.empty())
+              cookie_.append("; ");
+            cookie_.append(value);
+          } else if (name == "content-length") {
+            auto [ptr, ec] = std::from_chars(
+                value.data(), value.data() + value.size(), content_length);
+            valid = ec == std::errc{} && ptr == value.data() + value.size();
+          } else if (name == "host") {
+            host_.assign(value);
+          } else {
+            fields_.append(name).append(": ").append(value).append("\r\n");
+          }
+        });
+    if (!decoded)
+      return connection_error(http2::compression_error);
+
+    if (trailers) {
+      auto it = streams_.find(stream_id);
+      if (!valid) {
+        reset_stream(stream_id, http2::protocol_error);
+      } else if (it != streams_.end()) {
+        it->second.request_done = true;
+        dispatch(stream_id, it->second);
+      }
+      return true;
+    }
+
+    last_stream_id_ = stream_id;
+    if (!valid || method_.empty() || path_.empty() || scheme_.empty()) {
+      reset_stream(stream_id, http2::protocol_error);
+      return true;
+    }
+    if (streams_.size() >= http2::max_concurrent_streams) {
+      reset_stream(stream_id, http2::refused_stream);
+      return true;
+    }
+
+    stream &s = streams_[stream_id];
+    s.send_window = peer_window_size_;
+    s.recv_window = http2::stream_window_size;
+    s.content_length = content_length;
+    s.head_request = method_ == "HEAD";
+    s.head.reserve(method_.size() + path_.size() + fields_.size() + 64);
+    s.head.append(method_).append(" ").append(path_).append(" HTTP/1.1\r\n");
+    std::string_view host = authority_.empty() ? host_ : authority_;
+    if (!host.empty())
+      s.head.append("host: ").append(host).append("\r\n");
+    s.head.append(fields_);
+    if (!cookie_.empty())
+      s.head.append("cookie: ").append(cookie_).append("\r\n");
+
+    if (end_stream) {
+      s.request_done = true;
+      dispatch(stream_id, s);
+    }
+    return true;
+  }
+
+  bool on_settings(uint8_t flags, uint32_t stream_id,
+                   std::string_view payload) {
+    if (stream_id != 0)
+      return connection_error(http2::protocol_error);
+    if (flags & http2::flag_ack) {
+      if (!payload.empty())
+        return connection_error(http2::frame_size_error);
+      return true;
+    }
+    if (payload.size() % 6 != 0)
+      return connection_error(http2::frame_size_error);
+
+    settings_received_ = true;
+    for (size_t i = 0; i < payload.size(); i += 6) {
+      auto id = (http2::settings_id)((uint8_t)payload[i] << 8 |
+                                     (uint8_t)payload[i + 1]);
+      uint32_t value = http2::read_u32(payload.data() + i + 2);
+      switch (id) {
+      case http2::settings_id::header_table_size:
+        encoder_.set_max_table_size(value);
+        break;
+      case http2::settings_id::enable_push:
+        if (value > 1)
+          return connection_error(http2::protocol_error);
+        break;
+      case http2::settings_id::initial_window_size: {
+        if (value > http2::max_window_size)
+          return connection_error(http2::flow_control_error);
+        // applies to the open streams too
+        int64_t delta = (int64_t)value - peer_window_size_;
+        for (auto &[id, s] : streams_) {
+          s.send_window += delta;
+          if (s.send_window > http2::max_window_size)
+            return connection_error(http2::flow_control_error);
+        }
+        peer_window_size_ = value;
+      } break;
+      case http2::settings_id::max_frame_size:
+        if (value < http2::default_max_frame_size || value > 0xffffff)
+          return connection_error(http2::protocol_error);
+        peer_max_frame_size_ = value;
+        break;
+      default:
+        break;
+      }
+    }
+
+    write_frame_header(0, http2::frame_type::settings, http2::flag_ack, 0);
+    send_pending();
+    return true;
+  }
+
+  bool on_window_update(uint32_t stream_id, std::string_view payload) {
+    if (payload.size() != 4)
+      return connection_error(http2::frame_size_error);
+    uint32_t increment = http2::read_u32(payload.data()) & 0x7fffffff;
+
+    if (stream_id == 0) {
+      if (increment == 0)
+        return connection_error(http2::protocol_error);
+      send_window_ += increment;
+      if (send_window_ > http2::max_window_size)
+        return connection_error(http2::flow_control_error);
+    } else {
+      auto it = streams_.find(stream_id);
+      if (it == streams_.end()) {
+        // a closed stream may still see updates sent before it closed
+        if (stream_id > last_stream_id_)
+          return connection_error(http2::protocol_error);
+        return true;
+      }
+      if (increment == 0) {
+        reset_stream(stream_id, http2::protocol_error);
+        return true;
+      }
+      it->second.send_window += increment;
+      if (it->second.send_window > http2::max_window_size) {
+        reset_stream(stream_id, http2::flow_control_error);
+        return true;
+      }
+    }
+
+    send_pending();
+    return true;
+  }
+
+  // runs the handler for a stream whose request is complete and starts the
+  // response
+  void dispatch(uint32_t stream_id, stream &s) {
+    if (s.content_length >= 0 && (size_t)s.content_length != s.body.size()) {
+      reset_stream(stream_id, http2::protocol_error);
+      return;
+    }
+
+    if (!s.body.empty())
+      s.head.append("content-length: ")
+          .append(std::to_string(s.body.size()))
+          .append("\r\n");
+    s.head.append("\r\n");
+
+    req_.reset();
+    res_.reset();
+    req_.set_http_type(content_type::unknown);
+    if (!req_.load(s.head, s.body) || req_.parse_header(0) < 0) {
+      res_.set_status_and_content(status_type::bad_request);
+    } else if (req_.has_gzip() && !req_.uncompress()) {
+      res_.set_status_and_content(status_type::bad_request,
+                                  "gzip uncompress error");
+    } else if (is_form_urlencoded() && !req_.parse_form_urlencoded()) {
+      res_.set_status_and_content(status_type::bad_request,
+                                  "form urlencoded error");
+    } else {
+      http_handler_(req_, res_);
+    }
+
+    s.head = {};
+    s.body = {};
+    respond(stream_id, s);
+  }
+
+  bool is_form_urlencoded() {
+    if (req_.body_len() == 0)
+      return false;
+    auto content_type = req_.get_header_value("content-type");
+    if (content_type.find("application/x-www-form-urlencoded") ==
+        std::string_view::npos)
+      return false;
+    req_.set_http_type(content_type::urlencoded);
+    return true;
+  }
+
+  // translates the HTTP/1.1 response the handler built into frames
+  void respond(uint32_t stream_id, stream &s) {
+    std::string &rep_str = res_.response_str();
+    if (rep_str.empty() || res_.need_delay()) {
+      rep_str.clear();
+      reset_stream(stream_id, http2::internal_error);
+      return;
+    }
+
+    phr_header headers[64];
+    size_t num_headers = std::size(headers);
+    int minor_version, status;
+    const char *msg;
+    size_t msg_len;
+    int header_len =
+        phr_parse_response(rep_str.data(), rep_str.size(), &minor_version,
+                           &status, &msg, &msg_len, headers, &num_headers, 0);
+    if (header_len < 0) {
+      rep_str.clear();
+      reset_stream(stream_id, http2::internal_error);
+      return;
+    }
+
+    header_block_.clear();
+    encoder_.begin(header_block_);
+    char status_str[4];
+    std::to_chars(status_str, status_str + 3, status);
+    encoder_.encode(header_block_, ":status", std::string_view(status_str, 3));
+    for (size_t i = 0; i < num_headers; i++) {
+      std::string_view name(headers[i].name, headers[i].name_len);
+      if (http2::is_connection_header(name))
+        continue;
+      name_.assign(name);
+      std::transform(name_.begin(), name_.end(), name_.begin(),
+                     detail::header_lower);
+      // values that change with every response would only push the useful
+      // entries out of the table
+      bool indexing =
+          name_ != "content-length" && name_ != "date" && name_ != "set-cookie";
+      encoder_.encode(header_block_, name_,
+                      std::string_view(headers[i].value, headers[i].value_len),
+                      indexing);
+    }
+
+    std::string_view body(rep_str);
+    body.remove_prefix(header_len);
+    auto file = res_.take_file_body();
+    uint64_t file_size = file ? res_.file_body_size() : 0;
+    if (s.head_request) {
+      body = {};
+      file_size = 0;
+    }
+    write_headers(stream_id, header_block_, body.empty() && file_size == 0);
+
+    if (file_size > 0) {
+      rep_str.clear();
+      s.file = std::move(file);
+      s.file_left = file_size;
+      if (write_file(stream_id, s))
+        streams_.erase(stream_id);
+      return;
+    }
+
+    size_t sent = write_data(stream_id, s, body);
+    if (sent == body.size())
+      streams_.erase(stream_id);
+    else
+      s.pending.assign(body.substr(sent));
+    rep_str.clear();
+  }
+
+  void write_headers(uint32_t stream_id, std::string_view block,
+                     bool end_stream) {
+    auto type = http2::frame_type::headers;
+    uint8_t flags = end_stream ? http2::flag_end_stream : 0;
+    do {
+      size_t size = std::min<size_t>(block.size(), peer_max_frame_size_);
+      if (size == block.size())
+        flags |= http2::flag_end_headers;
+      write_frame_header(size, type, flags, stream_id);
+      out_.append(block.substr(0, size));
+      block.remove_prefix(size);
+      type = http2::frame_type::continuation;
+      flags = 0;
+    } while (!block.empty());
+  }
+
+  // writes as much of data as the flow control windows allow, the last frame
+  // ends the stream; returns the bytes written
+  size_t write_data(uint32_t stream_id, stream &s, std::string_view data) {
+    size_t sent = 0;
+    while (sent < data.size() && out_.size() < http2::max_queued_output) {
+      int64_t window = std::min(send_window_, s.send_window);
+      if (window <= 0)
+        break;
+
+      size_t size = std::min<size_t>(
+          {data.size() - sent, (size_t)window, peer_max_frame_size_});
+      bool last = sent + size == data.size();
+      write_frame_header(size, http2::frame_type::data,
+                         last ? http2::flag_end_stream : 0, stream_id);
+      out_.append(data.substr(sent, size));
+      sent += size;
+      send_window_ -= size;
+      s.send_window -= size;
+    }
+    return sent;
+  }
+
+  // reads the file body of s into DATA frames as far as the flow control
+  // windows and the output limit allow; true once it is all sent
+  bool write_file(uint32_t stream_id, stream &s) {
+    while (s.file_left > 0 && out_.size() < http2::max_queued_output) {
+      int64_t window = std::min(send_window_, s.send_window);
+      if (window <= 0)
+        return false;
+
+      size_t size = (size_t)std::min<uint64_t>(
+          {s.file_left, (uint64_t)window, peer_max_frame_size_});
+      bool last = size == s.file_left;
+      write_frame_header(size, http2::frame_type::data,
+                         last ? http2::flag_end_stream : 0, stream_id);
+      size_t pos = out_.size();
+      out_.resize(pos + size);
+      s.file->read(out_.data() + pos, size);
+      if ((size_t)s.file->gcount() != size) {
+        // the file shrank since the response was made
+        out_.resize(pos - http2::frame_header_size);
+        write_rst_stream(stream_id, http2::internal_error);
+        return true;
+      }
+
+      s.file_left -= size;
+      send_window_ -= size;
+      s.send_window -= size;
+    }
+    return s.file_left == 0;
+  }
+
+  // resumes the responses that were blocked by flow control or the output
+  // limit
+  void send_pending() {
+    auto it = streams_.begin();
+    while (it != streams_.end() && send_window_ > 0 &&
+           out_.size() < http2::max_queued_output) {
+      stream &s = it->second;
+      bool done;
+      if (s.file) {
+        done = write_file(it->first, s);
+      } else if (!s.pending.empty()) {
+        s.pending_pos += write_data(
+            it->first, s, std::string_view(s.pending).substr(s.pending_pos));
+        done = s.pending_pos == s.pending.size();
+      } else {
+        ++it;
+        continue;
+      }
+
+      if (done)
+        it = streams_.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  void write_frame_header(size_t length, http2::frame_type type, uint8_t flags,
+                          uint32_t stream_id) {
+    char h[5] = {(char)(length >> 16), (char)(length >> 8), (char)length,
+                 (char)type, (char)flags};
+    out_.append(h, sizeof(h));
+    http2::append_u32(out_, stream_id);
+  }
+
+  void write_window_update(uint32_t stream_id, uint32_t increment) {
+    write_frame_header(4, http2::frame_type::window_update, 0, stream_id);
+    http2::append_u32(out_, increment);
+  }
+
+  void write_rst_stream(uint32_t stream_id, http2::error_code code) {
+    write_frame_header(4, http2::frame_type::rst_stream, 0, stream_id);
+    http2::append_u32(out_, code);
+  }
+
+  void reset_stream(uint32_t stream_id, http2::error_code code) {
+    write_rst_stream(stream_id, code);
+    streams_.erase(stream_id);
+  }
+
+  // sends GOAWAY, the connection is closed once it is written; always false
+  bool connection_error(http2::error_code code) {
+    if (closing_)
+      return false;
+
+    write_frame_header(8, http2::frame_type::goaway, 0, 0);
+    http2::append_u32(out_, last_stream_id_);
+    http2::append_u32(out_, code);
+    closing_ = true;
+    return false;
+  }
+
+  void flush() {
+    if (writing_ || out_.empty())
+      return;
+
+    writing_ = true;
+    std::swap(out_, write_buf_);
+    conn_->reset_timer();
+    boost::asio::async_write(
+        conn_->socket(), boost::asio::buffer(write_buf_),
+        [this, self = this->shared_from_this()](
+            const boost::system::error_code &ec, std::size_t) {
+          writing_ = false;
+          write_buf_.clear();
+          if (ec) {
+            conn_->close();
+            return;
+          }
+
+          send_pending();
+          if (!out_.empty())
+            flush();
+          else if (closing_)
+            conn_->close();
+
+          if (read_paused_ && !closing_ &&
+              out_.size() + write_buf_.size() <= http2::max_queued_output) {
+            read_paused_ = false;
+            do_read();
+          }
+        });
+  }
+
+  std::shared_ptr<connection<SocketType>> conn_;
+  const std::function<void(request &, response &)> &http_handler_;
+  const size_t max_body_size_;
+  response res_;
+  request req_{res_};
+  hpack::decoder decoder_;
+  hpack::encoder encoder_;
+  std::map<uint32_t, stream> streams_;
+
+  std::vector<char> read_buf_;
+  std::string in_;
+  std::string out_;
+  std::string write_buf_;
+  bool writing_ = false;
+  bool read_paused_ = false;
+  bool closing_ = false;
+  bool preface_received_ = false;
+  bool settings_received_ = false;
+
+  uint32_t last_stream_id_ = 0;
+  uint32_t continuation_stream_ = 0;
+  bool continuation_end_stream_ = false;
+  std::string header_block_;
+
+  int64_t send_window_ = http2::default_window_size;
+  int64_t recv_window_ = http2::default_window_size;
+  uint32_t recv_consumed_ = 0;
+  int64_t peer_window_size_ = http2::default_window_size;
+  uint32_t peer_max_frame_size_ = http2::default_max_frame_size;
+
+  // scratch for building request heads and response header blocks
+  std::string method_;
+  std::string path_;
+  std::string scheme_;
+  std::string authority_;
+  std::string host_;
+  std::string fields_;
+  std::string cookie_;
+  std::string name_;
+};
+} // namespace cinatra
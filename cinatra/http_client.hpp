@@ -5,6 +5,7 @@
 #include "uri.hpp"
 #include "use_asio.hpp"
 #include <atomic>
+#include <charconv>
 #include <deque>
 #include <fstream>
 #include <future>
@@ -14,6 +15,14 @@
 #include <tuple>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 #ifdef CINATRA_ENABLE_SSL
 #ifdef ASIO_STANDALONE
 #include <asio/ssl.hpp>
@@ -41,6 +50,7 @@ inline static std::string FILE_SIZE_ERROR = "filesize error";
 inline static std::string RESP_PARSE_ERROR = "http response parse error";
 inline static std::string INVALID_CHUNK_SIZE = "invalid chunk size";
 inline static std::string READ_TIMEOUT = "read timeout";
+inline static std::string RANGE_ERROR = "range download error";
 
 class http_client : public std::enable_shared_from_this<http_client> {
 public:
@@ -407,6 +417,81 @@ public:
     async_get(std::move(src_file), nullptr, req_content_type::none, seconds);
   }
 
+  // download with `concurrency` connections, each fetching one byte range
+  // and writing it with pwrite into a preallocated dest_file. A probe request
+  // "Range: bytes=0-0" gets the file size from Content-Range; if the server
+  // ignores the range, the probe response is saved as the whole file.
+  template <typename _Callable_t>
+  auto download_ranges(std::string src_file, std::string dest_file,
+                       size_t concurrency, _Callable_t &&cb,
+                       size_t seconds = 60)
+      -> MODERN_CALLBACK_RESULT(void(response_data)) {
+    MODERN_CALLBACK_TRAITS(cb, void(response_data));
+    download_ranges_impl(std::move(src_file), std::move(dest_file),
+                         concurrency, MODERN_CALLBACK_CALL(), seconds);
+    MODERN_CALLBACK_RETURN();
+  }
+
+  void download_ranges_impl(std::string src_file, std::string dest_file,
+                            size_t concurrency, callback_t cb,
+                            size_t seconds = 60) {
+#ifdef _WIN32
+    (void)concurrency;
+    download_impl(std::move(src_file), std::move(dest_file), 0, std::move(cb),
+                  seconds);
+#else
+    auto parant_path = fs::path(dest_file).parent_path();
+    std::error_code code;
+    fs::create_directories(parant_path, code);
+    if (code) {
+      cb({boost::asio::error::make_error_code(
+              boost::asio::error::basic_errors::invalid_argument),
+          404, INVALID_FILE_PATH});
+      return;
+    }
+
+    auto probe = std::make_shared<http_client>(ios_);
+    probe->add_header("Range", "bytes=0-0");
+    probe->async_get(
+        src_file,
+        [this, self = shared_from_this(), probe, src_file, dest_file,
+         concurrency, cb = std::move(cb), seconds](response_data data) mutable {
+          boost::asio::post(ios_, [probe] { probe->close(); });
+          if (data.ec) {
+            cb(data);
+            return;
+          }
+
+          int64_t total = parse_content_range(data.resp_headers).total;
+          if (data.status != 200 && (data.status != 206 || total < 0)) {
+            // an error page isn't the file
+            cb({boost::asio::error::make_error_code(
+                    boost::asio::error::basic_errors::invalid_argument),
+                data.status, RANGE_ERROR, {}});
+            return;
+          }
+
+          if (data.status != 206) {
+            // the server doesn't support ranges, the probe got the whole file
+            std::ofstream file(dest_file, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+              cb({boost::asio::error::make_error_code(
+                      boost::asio::error::basic_errors::invalid_argument),
+                  404, OPEN_FAILED});
+              return;
+            }
+            file.write(data.resp_body.data(), data.resp_body.size());
+            cb({{}, data.status, "", {}});
+            return;
+          }
+
+          start_range_download(std::move(src_file), std::move(dest_file),
+                               total, concurrency, std::move(cb), seconds);
+        },
+        req_content_type::none, seconds);
+#endif
+  }
+
   template <typename _Callable_t>
   auto upload(std::string uri, std::string filename, _Callable_t &&cb,
               size_t seconds = 60) {
@@ -423,6 +508,12 @@ public:
                          req_content_type::multipart, seconds, "");
   }
 
+  // called with the file bytes sent so far and the total to send
+  void set_upload_progress(
+      std::function<void(size_t sent, size_t total)> progress) {
+    upload_progress_ = std::move(progress);
+  }
+
   void add_header(std::string key, std::string val) {
     if (key.empty())
       return;
@@ -490,18 +581,240 @@ private:
       return;
     }
 
+    // the last piece of the body first, cb_ may be waiting for all of it
+    if (on_chunk_) {
+      on_chunk_(ec, result);
+    }
+
     if (cb_) {
       cb_({ec, status, result, get_resp_headers()});
       cb_ = nullptr;
     }
 
-    if (on_chunk_) {
-      on_chunk_(ec, result);
+    in_progress_ = false;
+  }
+
+#ifndef _WIN32
+  struct range_download {
+    struct range {
+      int64_t offset;
+      int64_t end;
+      bool checked = false;
+    };
+
+    int fd = -1;
+    int64_t total = 0;
+    std::string dest_file;
+    std::vector<range> ranges;
+    std::vector<std::shared_ptr<http_client>> clients;
+    size_t left = 0;
+    bool done = false;
+    callback_t cb;
+
+    void on_data(size_t index, const boost::system::error_code &ec,
+                 std::string_view data) {
+      auto &r = ranges[index];
+      if (done || r.offset == r.end + 1) {
+        // the server may close the connection after a finished range
+        return;
+      }
+
+      if (ec) {
+        finish(ec, RANGE_ERROR);
+        return;
+      }
+
+      if (!r.checked) {
+        // an error page or another range must not end up in the file
+        auto &client = *clients[index];
+        auto range = parse_content_range(client.get_resp_headers());
+        if (client.parser_.status() != 206 || range.first != r.offset ||
+            range.last != r.end || range.total != total) {
+          finish(boost::asio::error::make_error_code(
+                     boost::asio::error::basic_errors::invalid_argument),
+                 RANGE_ERROR);
+          return;
+        }
+        r.checked = true;
+      }
+
+      if (r.offset + (int64_t)data.size() > r.end + 1) {
+        // the server sent more than the requested range
+        finish(boost::asio::error::make_error_code(
+                   boost::asio::error::basic_errors::invalid_argument),
+               RANGE_ERROR);
+        return;
+      }
+
+      size_t written = 0;
+      while (written < data.size()) {
+        auto n = ::pwrite(fd, data.data() + written, data.size() - written,
+                          r.offset + written);
+        if (n < 0) {
+          finish(std::error_code(errno, std::generic_category()),
+                 RANGE_ERROR);
+          return;
+        }
+        written += (size_t)n;
+      }
+      r.offset += data.size();
+
+      if (r.offset == r.end + 1 && --left == 0) {
+        verify();
+      }
     }
 
-    in_progress_ = false;
+    // the response is over, an empty or short body won't be followed by more
+    void on_complete(size_t index, const boost::system::error_code &ec) {
+      auto &r = ranges[index];
+      if (done || r.offset == r.end + 1) {
+        return;
+      }
+
+      finish(ec ? ec
+                : boost::asio::error::make_error_code(
+                      boost::asio::error::basic_errors::invalid_argument),
+             RANGE_ERROR);
+    }
+
+    void verify() {
+      bool complete = std::all_of(ranges.begin(), ranges.end(),
+                                  [](auto &r) { return r.offset == r.end + 1; });
+      std::error_code code;
+      if (!complete || (int64_t)fs::file_size(dest_file, code) != total ||
+          code) {
+        finish(boost::asio::error::make_error_code(
+                   boost::asio::error::basic_errors::invalid_argument),
+               FILE_SIZE_ERROR);
+        return;
+      }
+
+      finish({}, "");
+    }
+
+    void finish(const boost::system::error_code &ec, std::string_view msg) {
+      done = true;
+      ::close(fd);
+      fd = -1;
+      if (!clients.empty()) {
+        // we may be inside a client's on_chunk_, release them later
+        auto &ios = clients.front()->ios_;
+        boost::asio::post(ios, [clients = std::move(clients)] {
+          for (auto &client : clients) {
+            client->on_chunk_ = nullptr;
+            client->close();
+          }
+        });
+      }
+      cb({ec, ec ? 404 : 200, msg, {}});
+    }
+  };
+
+  void start_range_download(std::string src_file, std::string dest_file,
+                            int64_t total, size_t concurrency, callback_t cb,
+                            size_t seconds) {
+    auto state = std::make_shared<range_download>();
+    state->fd = ::open(dest_file.data(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (state->fd < 0 || ::ftruncate(state->fd, total) != 0) {
+      if (state->fd >= 0)
+        ::close(state->fd);
+      cb({boost::asio::error::make_error_code(
+              boost::asio::error::basic_errors::invalid_argument),
+          404, OPEN_FAILED});
+      return;
+    }
+
+    state->total = total;
+    state->dest_file = std::move(dest_file);
+    state->cb = std::move(cb);
+    if (total == 0) {
+      state->verify();
+      return;
+    }
+
+    size_t n = std::clamp<size_t>(concurrency, 1, (size_t)total);
+    int64_t part = total / n;
+    for (size_t i = 0; i < n; i++) {
+      int64_t start = i * part;
+      int64_t end = (i == n - 1) ? total - 1 : start + part - 1;
+      state->ranges.push_back({start, end});
+    }
+    state->left = n;
+
+    for (size_t i = 0; i < n; i++) {
+      auto client = std::make_shared<http_client>(ios_);
+      auto &r = state->ranges[i];
+      client->add_header("Range", "bytes=" + std::to_string(r.offset) + "-" +
+                                      std::to_string(r.end));
+      state->clients.push_back(client);
+    }
+
+    // copy the clients, a failed connect may finish and clear state->clients
+    auto clients = state->clients;
+    for (size_t i = 0; i < n; i++) {
+      clients[i]->on_chunk_ = [state, i](boost::system::error_code ec,
+                                         std::string_view data) {
+        state->on_data(i, ec, data);
+      };
+      clients[i]->async_get(
+          src_file,
+          [state, i](response_data data) { state->on_complete(i, data.ec); },
+          req_content_type::none, seconds);
+    }
   }
 
+  struct content_range {
+    int64_t first = -1;
+    int64_t last = -1;
+    int64_t total = -1;
+  };
+
+  // Content-Range: bytes 0-0/12345, -1 for the parts that are missing
+  static content_range
+  parse_content_range(std::pair<phr_header *, size_t> headers) {
+    content_range range;
+    for (size_t i = 0; i < headers.second; i++) {
+      std::string_view name(headers.first[i].name, headers.first[i].name_len);
+      if (!iequal(name.data(), name.size(), "content-range")) {
+        continue;
+      }
+
+      std::string_view value(headers.first[i].value,
+                             headers.first[i].value_len);
+      auto to_int = [](std::string_view str, int64_t &n) {
+        auto end = str.data() + str.size();
+        auto [ptr, ec] = std::from_chars(str.data(), end, n);
+        return ec == std::errc{} && ptr == end;
+      };
+      auto slash = value.rfind('/');
+      if (slash == std::string_view::npos) {
+        break;
+      }
+      if (int64_t total; to_int(value.substr(slash + 1), total)) {
+        range.total = total;
+      }
+
+      // "bytes */12345" has no range
+      auto spec = value.substr(0, slash);
+      if (!spec.starts_with("bytes ")) {
+        break;
+      }
+      spec.remove_prefix(6);
+      auto dash = spec.find('-');
+      int64_t first, last;
+      if (dash != std::string_view::npos &&
+          to_int(spec.substr(0, dash), first) &&
+          to_int(spec.substr(dash + 1), last)) {
+        range.first = first;
+        range.last = last;
+      }
+      break;
+    }
+
+    return range;
+  }
+#endif
+
   std::pair<bool, uri_t> get_uri(const std::string &uri) {
     uri_t u;
     if (!u.parse_from(uri.data())) {
@@ -622,9 +935,104 @@ private:
         ctx, total_multipart_size(left_file_size, multipart_str.size()));
     write_str.append(multipart_str);
     multipart_str_ = std::move(write_str);
+    upload_sent_ = 0;
+    upload_total_ = left_file_size;
+
+#ifdef __linux__
+    if (!is_ssl()) {
+      // the file body goes from the page cache to the socket with sendfile,
+      // only the preamble and the epilogue are built in memory
+      file->close();
+      int fd = ::open(filename.data(), O_RDONLY);
+      if (fd < 0) {
+        callback(boost::asio::error::make_error_code(
+                     boost::asio::error::basic_errors::invalid_argument),
+                 OPEN_FAILED);
+        return;
+      }
+
+      auto file_fd = std::shared_ptr<int>(new int(fd), [](int *p) {
+        ::close(*p);
+        delete p;
+      });
+      async_write(multipart_str_,
+                  [this, self = shared_from_this(), file_fd,
+                   left_file_size](boost::system::error_code ec, std::size_t) {
+                    if (ec) {
+                      callback(ec);
+                      close();
+                      return;
+                    }
+
+                    sendfile_data(file_fd, (off_t)start_, left_file_size);
+                  });
+      return;
+    }
+#endif
+
     send_file_data(std::move(file));
   }
 
+#ifdef __linux__
+  void sendfile_data(std::shared_ptr<int> fd, off_t offset, size_t left) {
+    if (left == 0) {
+      multipart_str_ = MULTIPART_END;
+      async_write(multipart_str_,
+                  [this, self = shared_from_this()](
+                      boost::system::error_code ec, std::size_t) {
+                    if (ec) {
+                      callback(ec);
+                      close();
+                    }
+                  });
+      return;
+    }
+
+    boost::system::error_code ec;
+    socket_.native_non_blocking(true, ec);
+    const size_t max_size = 3 * 1024 * 1024;
+    ssize_t n = ::sendfile(socket_.native_handle(), *fd, &offset,
+                           (std::min)(left, max_size));
+    if (n > 0) {
+      left -= (size_t)n;
+      notify_upload_progress((size_t)n);
+    } else if (n == 0) {
+      // the file was truncated while sending
+      callback(boost::asio::error::make_error_code(
+                   boost::asio::error::basic_errors::invalid_argument),
+               FILE_SIZE_ERROR);
+      close();
+      return;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      callback(std::error_code(errno, std::generic_category()));
+      close();
+      return;
+    }
+
+    // send the next part when the socket is writable again, this also lets
+    // other handlers of the io_service run between the parts
+    socket_.async_wait(
+        boost::asio::ip::tcp::socket::wait_write,
+        [this, self = shared_from_this(), fd = std::move(fd), offset,
+         left](boost::system::error_code ec) {
+          if (ec) {
+            callback(ec);
+            close();
+            return;
+          }
+
+          sendfile_data(std::move(fd), offset, left);
+        });
+  }
+#endif
+
+  void notify_upload_progress(size_t size) {
+    upload_sent_ += size;
+    if (upload_progress_) {
+      upload_progress_(upload_sent_, upload_total_);
+    }
+  }
+
   void handshake(context ctx) {
 #ifdef CINATRA_ENABLE_SSL
     auto self = this->shared_from_this();
@@ -855,7 +1263,7 @@ private:
       read_buf_.consume(length + CRCF.size());
       read_chunk_head(keep_alive);
     } else {
-      callback({}, 200, chunked_result_);
+      callback({}, parser_.status(), chunked_result_);
       clear_chunk_buffer();
       do_read();
     }
@@ -1028,9 +1436,10 @@ private:
                     boost::system::error_code ec, std::size_t) mutable {
                   if (!ec) {
                     multipart_str_.clear();
+                    notify_upload_progress(upload_pending_);
                     send_file_data(std::move(file));
                   } else {
-                    on_chunk_(ec, "send failed");
+                    callback(ec);
                     close();
                   }
                 });
@@ -1071,6 +1480,7 @@ private:
     }
 
     multipart_str_.append(content);
+    upload_pending_ = (size_t)read_len;
     if (eof) {
       multipart_str_.append(MULTIPART_END);
     }
@@ -1147,6 +1557,10 @@ private:
 
   std::string multipart_str_;
   size_t start_;
+  size_t upload_sent_ = 0;
+  size_t upload_pending_ = 0;
+  size_t upload_total_ = 0;
+  std::function<void(size_t, size_t)> upload_progress_ = nullptr;
 
   std::string last_domain_;
   std::promise<bool> read_close_finished_;
@@ -112,7 +112,9 @@ public:
       try {
         acceptor->bind(endpoint);
         acceptor->listen();
-        start_accept(acceptor);
+        for (std::size_t i = 0; i < accept_concurrency_; i++) {
+          start_accept(acceptor);
+        }
         r = true;
       } catch (const std::exception &ex) {
         err_msg = ex.what();
@@ -136,6 +138,8 @@ public:
 
   intptr_t run_one() { return io_service_pool_.run_one(); }
 
+  service_pool_policy &get_io_service_pool() { return io_service_pool_; }
+
   intptr_t poll() { return io_service_pool_.poll(); }
 
   intptr_t poll_one() { return io_service_pool_.poll_one(); }
@@ -157,6 +161,29 @@ public:
 
   void set_keep_alive_timeout(long seconds) { keep_alive_timeout_ = seconds; }
 
+  // how many accepts are kept pending on each listening socket, should be
+  // called before listen. On io_uring each one is a queued accept request,
+  // so bursts of new connections don't wait for the accept to be re-armed
+  void set_accept_concurrency(std::size_t n) {
+    accept_concurrency_ = n == 0 ? 1 : n;
+  }
+
+  // the event loop the io_services run on, fixed at build time
+  static constexpr std::string_view io_backend() {
+#if defined(ASIO_HAS_IO_URING_AS_DEFAULT) ||                                   \
+    defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+    return "io_uring";
+#elif defined(ASIO_HAS_EPOLL) || defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(ASIO_HAS_KQUEUE) || defined(BOOST_ASIO_HAS_KQUEUE)
+    return "kqueue";
+#elif defined(ASIO_HAS_IOCP) || defined(BOOST_ASIO_HAS_IOCP)
+    return "iocp";
+#else
+    return "select";
+#endif
+  }
+
   template <typename T> bool need_cache(T &&t) {
     if constexpr (std::is_same_v<T, enable_cache<bool>>) {
       return t.value;
@@ -236,6 +263,10 @@ public:
 
   void enable_timeout(bool enable) { enable_timeout_ = enable; }
 
+  // serves HTTP/2 to clients that start with its preface (h2c with prior
+  // knowledge) or, with SSL, negotiate h2 by ALPN
+  void enable_http2(bool enable) { enable_http2_ = enable; }
+
   void enable_response_time(bool enable) { need_response_time_ = enable; }
 
   void set_transfer_type(transfer_type type) { transfer_type_ = type; }
@@ -248,35 +279,18 @@ public:
 private:
   void start_accept(
       std::shared_ptr<boost::asio::ip::tcp::acceptor> const &acceptor) {
-    auto new_conn = std::make_shared<connection<ScoketType>>(
-        io_service_pool_.get_io_service(), ssl_conf_, max_req_buf_size_,
-        keep_alive_timeout_, http_handler_, upload_dir_,
-        upload_check_ ? &upload_check_ : nullptr);
+    if (io_service_pool_.mode() == pool_mode::least_connections) {
+      accept_least_loaded(acceptor);
+      return;
+    }
 
+    auto [io_service, token] = io_service_pool_.get_io_service_for_connection();
+    auto new_conn = make_connection(io_service, std::move(token));
     acceptor->async_accept(
         new_conn->tcp_socket(),
         [this, new_conn, acceptor](const boost::system::error_code &e) {
           if (!e) {
-            new_conn->tcp_socket().set_option(
-                boost::asio::ip::tcp::no_delay(true));
-            if (multipart_begin_) {
-              new_conn->set_multipart_begin(multipart_begin_);
-            }
-
-            new_conn->enable_response_time(need_response_time_);
-            new_conn->enable_timeout(enable_timeout_);
-
-            if (check_headers_) {
-              new_conn->set_validate(max_header_len_, check_headers_);
-            }
-
-            if (!on_conn_) {
-              new_conn->start();
-            } else {
-              if (on_conn_(new_conn)) {
-                new_conn->start();
-              }
-            }
+            start_connection(new_conn);
           } else {
             // LOG_INFO << "server::handle_accept: " << e.message();
           }
@@ -285,6 +299,93 @@ private:
         });
   }
 
+  // the io_service is picked per connection, not per pending accept: with
+  // several accepts pending an early pick would count them as connections
+  // and may be stale by the time a client comes
+  void accept_least_loaded(
+      std::shared_ptr<boost::asio::ip::tcp::acceptor> const &acceptor) {
+    acceptor->async_accept([this, acceptor](
+                               const boost::system::error_code &e,
+                               boost::asio::ip::tcp::socket socket) {
+      if (!e) {
+        auto [io_service, token] =
+            io_service_pool_.get_io_service_for_connection();
+        auto new_conn = make_connection(io_service, std::move(token));
+        if (move_socket(std::move(socket), new_conn->tcp_socket())) {
+          start_connection(new_conn);
+        }
+      } else {
+        // LOG_INFO << "server::handle_accept: " << e.message();
+      }
+
+      start_accept(acceptor);
+    });
+  }
+
+  std::shared_ptr<connection<ScoketType>>
+  make_connection(boost::asio::io_service &io_service, load_token token) {
+    auto new_conn = std::make_shared<connection<ScoketType>>(
+        io_service, ssl_conf_, max_req_buf_size_, keep_alive_timeout_,
+        http_handler_, upload_dir_, upload_check_ ? &upload_check_ : nullptr);
+    new_conn->set_load_token(std::move(token));
+    return new_conn;
+  }
+
+  void
+  start_connection(std::shared_ptr<connection<ScoketType>> const &new_conn) {
+    new_conn->tcp_socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    if (multipart_begin_) {
+      new_conn->set_multipart_begin(multipart_begin_);
+    }
+
+    new_conn->enable_response_time(need_response_time_);
+    new_conn->enable_timeout(enable_timeout_);
+    new_conn->enable_http2(enable_http2_);
+
+    if (check_headers_) {
+      new_conn->set_validate(max_header_len_, check_headers_);
+    }
+
+    if (!on_conn_) {
+      new_conn->start();
+    } else {
+      if (on_conn_(new_conn)) {
+        new_conn->start();
+      }
+    }
+  }
+
+  // hands an accepted socket to the io_service of target; one accepted on
+  // another io_service is released from it and assigned to target's, which
+  // costs a few syscalls and needs Windows 8.1 with IOCP
+  static bool move_socket(boost::asio::ip::tcp::socket socket,
+                          boost::asio::ip::tcp::socket &target) {
+    using boost::asio::execution::context;
+    if (&boost::asio::query(socket.get_executor(), context) ==
+        &boost::asio::query(target.get_executor(), context)) {
+      target = std::move(socket);
+      return true;
+    }
+
+    boost::system::error_code ec;
+    auto protocol = socket.local_endpoint(ec).protocol();
+    if (ec)
+      return false;
+    auto handle = socket.release(ec);
+    if (ec)
+      return false;
+    target.assign(protocol, handle, ec);
+    if (ec) {
+#ifdef _WIN32
+      ::closesocket(handle);
+#else
+      ::close(handle);
+#endif
+      return false;
+    }
+    return true;
+  }
+
   void set_static_res_handler() {
     set_http_handler<POST, GET>(
         STATIC_RESOURCE,
@@ -315,6 +416,7 @@ private:
               return;
             }
 
+            std::error_code ec;
             auto start_sv = req.get_header_value("cinatra_start_pos");
             if (!start_sv.empty()) {
               std::string start_str(start_sv);
@@ -326,7 +428,16 @@ private:
               }
             }
 
+            // an HTTP/2 stream has no connection of its own to stream the
+            // file through, the session reads it as the stream's window opens
+            if (req.get_conn<ScoketType>() == nullptr) {
+              send_file_body(req, res, std::move(in), mime,
+                             fs::file_size(fullpath, ec));
+              return;
+            }
+
             req.get_conn<ScoketType>()->set_tag(in);
+            req.save_request_static_file_size(fs::file_size(fullpath, ec));
 
             // if(is_small_file(in.get(),req)){
             //	send_small_file(res, in.get(), mime);
@@ -393,6 +504,48 @@ private:
 #endif
   }
 
+  // the file as the body of res, or the part a "Range: bytes=start-end"
+  // asks for; a range that can't be satisfied is ignored and the whole file
+  // sent
+  void send_file_body(request &req, response &res,
+                      std::shared_ptr<std::ifstream> in, std::string_view mime,
+                      std::int64_t file_size) {
+    res.add_header("Access-Control-Allow-origin", "*");
+    res.add_header("Accept-Ranges", "bytes");
+    res.add_header("Content-type",
+                   std::string(mime.data(), mime.size()) + "; charset=utf8");
+    if (static_res_cache_max_age_ > 0) {
+      std::string max_age =
+          std::string("max-age=") + std::to_string(static_res_cache_max_age_);
+      res.add_header("Cache-Control", max_age.data());
+    }
+
+    std::int64_t start = in->tellg();
+    auto range_header = req.get_header_value("range");
+    req.set_range_flag(!range_header.empty());
+    req.set_range_start_pos(range_header);
+    if (req.is_range()) {
+      std::int64_t range_start = req.get_range_start_pos();
+      std::int64_t end_pos = req.get_range_end_pos();
+      if (end_pos < 0 || end_pos >= file_size)
+        end_pos = file_size - 1;
+      if (range_start >= 0 && range_start <= end_pos) {
+        in->seekg(range_start);
+        res.add_header("Content-Range",
+                       "bytes " + std::to_string(range_start) + "-" +
+                           std::to_string(end_pos) + "/" +
+                           std::to_string(file_size));
+        res.set_status_and_file(status_type::partial_content, std::move(in),
+                                end_pos + 1 - range_start);
+        return;
+      }
+    }
+
+    if (start < 0 || start > file_size)
+      start = 0;
+    res.set_status_and_file(status_type::ok, std::move(in), file_size - start);
+  }
+
   void write_chunked_header(request &req, std::shared_ptr<std::ifstream> in,
                             std::string_view mime) {
     auto range_header = req.get_header_value("range");
@@ -414,23 +567,39 @@ private:
 
     if (req.is_range()) {
       std::int64_t file_pos = req.get_range_start_pos();
+      std::int64_t file_size = req.get_request_static_file_size();
+      std::int64_t end_pos = req.get_range_end_pos();
+      if (end_pos < 0 || end_pos >= file_size) {
+        end_pos = file_size - 1;
+      }
+      req.set_range_end_pos(end_pos);
       in->seekg(file_pos);
-      auto end_str = std::to_string(req.get_request_static_file_size());
+      auto end_str = std::to_string(file_size);
       res_content_header +=
           std::string("\r\n") + std::string("Content-Range: bytes ") +
           std::to_string(file_pos) + std::string("-") +
-          std::to_string(req.get_request_static_file_size() - 1) +
-          std::string("/") + end_str;
+          std::to_string(end_pos) + std::string("/") + end_str;
     }
     req.get_conn<ScoketType>()->write_chunked_header(
         std::string_view(res_content_header), req.is_range());
   }
 
   void write_chunked_body(request &req) {
-    const size_t len = 3 * 1024 * 1024;
+    size_t len = 3 * 1024 * 1024;
+    bool last_part = false;
+    if (req.is_range()) {
+      // stop at the end of "Range: bytes=start-end"
+      auto conn = req.get_conn<ScoketType>();
+      auto in = std::any_cast<std::shared_ptr<std::ifstream>>(conn->get_tag());
+      std::int64_t left = req.get_range_end_pos() + 1 - (std::int64_t)in->tellg();
+      if (left <= (std::int64_t)len) {
+        len = left > 0 ? (size_t)left : 0;
+        last_part = true;
+      }
+    }
     auto str = get_send_data(req, len);
     auto read_len = str.size();
-    bool eof = (read_len == 0 || read_len != len);
+    bool eof = (last_part || read_len == 0 || read_len != len);
     req.get_conn<ScoketType>()->write_chunked_data(std::move(str), eof);
   }
 
@@ -533,6 +702,7 @@ private:
 
   std::size_t max_req_buf_size_ = 3 * 1024 * 1024; // max request buffer size 3M
   long keep_alive_timeout_ = 60;                   // max request timeout 60s
+  std::size_t accept_concurrency_ = 1;
 
   http_router http_router_;
   std::string static_dir_ = fs::absolute("www").string(); // default
@@ -540,6 +710,7 @@ private:
   std::time_t static_res_cache_max_age_ = 0;
 
   bool enable_timeout_ = true;
+  bool enable_http2_ = false;
   http_handler http_handler_ = nullptr;
   std::function<bool(request &req, response &res)> download_check_;
   std::vector<std::string> relate_paths_;
@@ -1,14 +1,61 @@
 #pragma once
 #include "use_asio.hpp"
 #include "utils.hpp"
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace cinatra {
+// how the pool hands out io_services to new connections
+enum class pool_mode {
+  round_robin,
+  // pick the io_service with the fewest live connections, keeps a few heavy
+  // keep-alive connections from piling up on one thread
+  least_connections,
+};
+
+// keeps a connection counted by the pool until it is destroyed
+using load_token = std::shared_ptr<void>;
+
+struct io_thread_options {
+  // the i-th io thread is pinned to cpu_sets[i % cpu_sets.size()], a set can
+  // hold one core or a core list; empty means no pinning
+  std::vector<std::vector<int>> cpu_sets;
+  // the i-th io thread is named name_prefix + i, e.g. "cinatra_io3"
+  std::string name_prefix;
+  // runs on the i-th io thread after pinning, before it runs the io_service;
+  // per-thread buffers and arenas allocated and touched here are placed on
+  // the thread's local NUMA node by the kernel's first-touch policy
+  std::function<void(std::size_t index)> on_thread_start;
+};
+
+// where an io thread actually runs, for operators to verify the pinning
+struct io_thread_info {
+  std::size_t index = 0;
+  std::string name;
+  std::vector<int> cpus; // the requested cpus, empty if not pinned
+  int cpu = -1;          // the cpu the thread started on
+  int numa_node = -1;
+  bool pinned = false;   // pinning was requested and succeeded
+};
+
 class io_service_pool : private noncopyable {
 public:
-  explicit io_service_pool(std::size_t pool_size) : next_io_service_(0) {
+  explicit io_service_pool(std::size_t pool_size,
+                           pool_mode mode = pool_mode::round_robin,
+                           io_thread_options options = {})
+      : next_io_service_(0), mode_(mode),
+        connections_(pool_size == 0 ? 1 : pool_size),
+        options_(std::move(options)) {
     if (pool_size == 0)
       pool_size = 1; // set default value as 1
 
@@ -24,7 +71,11 @@ public:
     std::vector<std::shared_ptr<std::thread>> threads;
     for (std::size_t i = 0; i < io_services_.size(); ++i) {
       threads.emplace_back(std::make_shared<std::thread>(
-          [](io_service_ptr svr) { svr->run(); }, io_services_[i]));
+          [this, i](io_service_ptr svr) {
+            init_thread(i);
+            svr->run();
+          },
+          io_services_[i]));
     }
 
     for (std::size_t i = 0; i < threads.size(); ++i)
@@ -44,21 +95,117 @@ public:
       io_services_[i]->stop();
   }
 
+  // may be called from any thread, e.g. by client_factory::new_client
   boost::asio::io_service &get_io_service() {
-    boost::asio::io_service &io_service = *io_services_[next_io_service_];
-    ++next_io_service_;
-    if (next_io_service_ == io_services_.size())
-      next_io_service_ = 0;
-    return io_service;
+    std::size_t index = next_io_service_.fetch_add(1, std::memory_order_relaxed);
+    return *io_services_[index % io_services_.size()];
+  }
+
+  boost::asio::io_service &get_io_service(std::size_t index) {
+    return *io_services_[index % io_services_.size()];
+  }
+
+  // the io_service for a new connection, chosen by pool_mode; the
+  // connection must hold the token for as long as it lives
+  std::pair<boost::asio::io_service &, load_token>
+  get_io_service_for_connection() {
+    std::size_t index = 0;
+    if (mode_ == pool_mode::least_connections) {
+      std::size_t min_count = SIZE_MAX;
+      for (std::size_t i = 0; i < connections_.size(); ++i) {
+        std::size_t count = connections_[i].load(std::memory_order_relaxed);
+        if (count < min_count) {
+          min_count = count;
+          index = i;
+        }
+      }
+    } else {
+      index = next_io_service_.fetch_add(1, std::memory_order_relaxed) %
+              io_services_.size();
+    }
+
+    auto &count = connections_[index];
+    count.fetch_add(1, std::memory_order_relaxed);
+    load_token token(&count, [](std::atomic<std::size_t> *p) {
+      p->fetch_sub(1, std::memory_order_relaxed);
+    });
+    return {*io_services_[index], std::move(token)};
+  }
+
+  // live connections on the index-th io_service
+  std::size_t connection_count(std::size_t index) const {
+    return connections_[index % connections_.size()].load(
+        std::memory_order_relaxed);
+  }
+
+  std::size_t size() const { return io_services_.size(); }
+
+  pool_mode mode() const { return mode_; }
+
+  // filled in as the io threads start
+  std::vector<io_thread_info> thread_mapping() {
+    std::lock_guard<std::mutex> lock(mapping_mtx_);
+    return mapping_;
   }
 
 private:
+  void init_thread(std::size_t index) {
+    io_thread_info info;
+    info.index = index;
+    if (!options_.name_prefix.empty()) {
+      info.name = options_.name_prefix + std::to_string(index);
+    }
+    if (!options_.cpu_sets.empty()) {
+      info.cpus = options_.cpu_sets[index % options_.cpu_sets.size()];
+    }
+
+#ifdef __linux__
+    if (!info.name.empty()) {
+      // linux limits thread names to 15 characters
+      pthread_setname_np(pthread_self(), info.name.substr(0, 15).data());
+    }
+
+    if (!info.cpus.empty()) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      for (int cpu : info.cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &cpu_set);
+      }
+      // fall back to running unpinned, e.g. when a cpu is offline
+      info.pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                           &cpu_set) == 0;
+    }
+
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+      info.cpu = (int)cpu;
+      info.numa_node = (int)node;
+    }
+#endif
+
+    {
+      std::lock_guard<std::mutex> lock(mapping_mtx_);
+      mapping_.push_back(info);
+    }
+
+    if (options_.on_thread_start) {
+      options_.on_thread_start(index);
+    }
+  }
+
   using io_service_ptr = std::shared_ptr<boost::asio::io_service>;
   using work_ptr = std::shared_ptr<boost::asio::io_service::work>;
 
   std::vector<io_service_ptr> io_services_;
   std::vector<work_ptr> work_;
-  std::size_t next_io_service_;
+  std::atomic<std::size_t> next_io_service_;
+  pool_mode mode_;
+  std::vector<std::atomic<std::size_t>> connections_;
+  io_thread_options options_;
+  std::mutex mapping_mtx_;
+  std::vector<io_thread_info> mapping_;
 };
 
 class io_service_inplace : private noncopyable {
@@ -85,6 +232,13 @@ public:
 
   boost::asio::io_service &get_io_service() { return *io_services_; }
 
+  std::pair<boost::asio::io_service &, load_token>
+  get_io_service_for_connection() {
+    return {*io_services_, nullptr};
+  }
+
+  pool_mode mode() const { return pool_mode::round_robin; }
+
 private:
   using io_service_ptr = std::shared_ptr<boost::asio::io_service>;
   using work_ptr = std::shared_ptr<boost::asio::io_service::work>;
@@ -2,6 +2,7 @@
 #define _MULTIPART_READER_H_
 
 #include "multipart_parser.hpp"
+#include <functional>
 #include <map>
 #include <string>
 #include <utility>
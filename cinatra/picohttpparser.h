@@ -29,9 +29,22 @@
 #include <assert.h>
 #include <stddef.h>
 #include <string.h>
-#ifdef __SSE4_2__
+/* on x86 with gcc/clang the SSE4.2 and AVX2 scanners are built with target
+ * attributes and picked at runtime, no -msse4.2 or -mavx2 needed */
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#define PHR_RUNTIME_DISPATCH 1
+#endif
+#if defined(PHR_RUNTIME_DISPATCH) || defined(__SSE4_2__)
+#define PHR_HAS_SSE42 1
+#endif
+#if defined(PHR_RUNTIME_DISPATCH) || defined(__AVX2__)
+#define PHR_HAS_AVX2 1
+#endif
+
+#if defined(PHR_HAS_SSE42) || defined(PHR_HAS_AVX2)
 #ifdef _MSC_VER
-#include <nmmintrin.h>
+#include <immintrin.h>
 #else
 #include <x86intrin.h>
 #endif
@@ -167,109 +180,6 @@ static const char *token_char_map =
     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
 
-static const char *findchar_fast(const char *buf, const char *buf_end,
-                                 const char *ranges, int ranges_size,
-                                 int *found) {
-  *found = 0;
-#if __SSE4_2__
-  if (likely(buf_end - buf >= 16)) {
-    __m128i ranges16 = _mm_loadu_si128((const __m128i *)ranges);
-
-    size_t left = (buf_end - buf) & ~15;
-    do {
-      __m128i b16 = _mm_loadu_si128((const __m128i *)buf);
-      int r = _mm_cmpestri(ranges16, ranges_size, b16, 16,
-                           _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES |
-                               _SIDD_UBYTE_OPS);
-      if (unlikely(r != 16)) {
-        buf += r;
-        *found = 1;
-        break;
-      }
-      buf += 16;
-      left -= 16;
-    } while (likely(left != 0));
-  }
-#else
-  /* suppress unused parameter warning */
-  (void)buf_end;
-  (void)ranges;
-  (void)ranges_size;
-#endif
-  return buf;
-}
-
-static const char *get_token_to_eol(const char *buf, const char *buf_end,
-                                    const char **token, size_t *token_len,
-                                    int *ret) {
-  const char *token_start = buf;
-
-#ifdef __SSE4_2__
-  static const char ranges1[] = "\0\010"
-                                /* allow HT */
-                                "\012\037"
-                                /* allow SP and up to but not including DEL */
-                                "\177\177"
-      /* allow chars w. MSB set */
-      ;
-  int found;
-  buf = findchar_fast(buf, buf_end, ranges1, sizeof(ranges1) - 1, &found);
-  if (found)
-    goto FOUND_CTL;
-#else
-  /* find non-printable char within the next 8 bytes, this is the hottest code;
-   * manually inlined */
-  while (likely(buf_end - buf >= 8)) {
-#define DOIT()                                                                 \
-  do {                                                                         \
-    if (unlikely(!IS_PRINTABLE_ASCII(*buf)))                                   \
-      goto NonPrintable;                                                       \
-    ++buf;                                                                     \
-  } while (0)
-    DOIT();
-    DOIT();
-    DOIT();
-    DOIT();
-    DOIT();
-    DOIT();
-    DOIT();
-    DOIT();
-#undef DOIT
-    continue;
-  NonPrintable:
-    if ((likely((unsigned char)*buf < '\040') && likely(*buf != '\011')) ||
-        unlikely(*buf == '\177')) {
-      goto FOUND_CTL;
-    }
-    ++buf;
-  }
-#endif
-  for (;; ++buf) {
-    CHECK_EOF();
-    if (unlikely(!IS_PRINTABLE_ASCII(*buf))) {
-      if ((likely((unsigned char)*buf < '\040') && likely(*buf != '\011')) ||
-          unlikely(*buf == '\177')) {
-        goto FOUND_CTL;
-      }
-    }
-  }
-FOUND_CTL:
-  if (likely(*buf == '\015')) {
-    ++buf;
-    EXPECT_CHAR('\012');
-    *token_len = buf - 2 - token_start;
-  } else if (*buf == '\012') {
-    *token_len = buf - token_start;
-    ++buf;
-  } else {
-    *ret = -1;
-    return NULL;
-  }
-  *token = token_start;
-
-  return buf;
-}
-
 static const char *is_complete(const char *buf, const char *buf_end,
                                size_t last_len, int *ret) {
   int ret_cnt = 0;
@@ -336,112 +246,74 @@ static const char *parse_http_version(const char *buf, const char *buf_end,
   return buf;
 }
 
-static const char *parse_headers(const char *buf, const char *buf_end,
-                                 struct phr_header *headers,
-                                 size_t *num_headers, size_t max_headers,
-                                 int *ret) {
-  for (;; ++*num_headers) {
-    CHECK_EOF();
-    if (*buf == '\015') {
-      ++buf;
-      EXPECT_CHAR('\012');
-      break;
-    } else if (*buf == '\012') {
-      ++buf;
-      break;
-    }
-    if (*num_headers == max_headers) {
-      *ret = -1;
-      return NULL;
-    }
-    if (!(*num_headers != 0 && (*buf == ' ' || *buf == '\t'))) {
-      /* parsing name, but do not discard SP before colon, see
-       * http://www.mozilla.org/security/announce/2006/mfsa2006-33.html */
-      headers[*num_headers].name = buf;
-      static const char ALIGNED(16) ranges1[] =
-          "\x00 "  /* control chars and up to SP */
-          "\"\""   /* 0x22 */
-          "()"     /* 0x28,0x29 */
-          ",,"     /* 0x2c */
-          "//"     /* 0x2f */
-          ":@"     /* 0x3a-0x40 */
-          "[]"     /* 0x5b-0x5d */
-          "{\377"; /* 0x7b-0xff */
-      int found;
-      buf = findchar_fast(buf, buf_end, ranges1, sizeof(ranges1) - 1, &found);
-      if (!found) {
-        CHECK_EOF();
-      }
-      while (1) {
-        if (*buf == ':') {
-          break;
-        } else if (!token_char_map[(unsigned char)*buf]) {
-          *ret = -1;
-          return NULL;
-        }
-        ++buf;
-        CHECK_EOF();
-      }
-      if ((headers[*num_headers].name_len = buf - headers[*num_headers].name) ==
-          0) {
-        *ret = -1;
-        return NULL;
-      }
-      ++buf;
-      for (;; ++buf) {
-        CHECK_EOF();
-        if (!(*buf == ' ' || *buf == '\t')) {
-          break;
-        }
-      }
-    } else {
-      headers[*num_headers].name = NULL;
-      headers[*num_headers].name_len = 0;
-    }
-    if ((buf = get_token_to_eol(buf, buf_end, &headers[*num_headers].value,
-                                &headers[*num_headers].value_len, ret)) ==
-        NULL) {
-      return NULL;
-    }
-  }
-  return buf;
+/* 0: scalar, 1: SSE4.2, 2: AVX2 */
+static int phr_detect_simd_level(void) {
+#if defined(PHR_RUNTIME_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return 2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return 1;
+  return 0;
+#elif defined(__AVX2__)
+  return 2;
+#elif defined(__SSE4_2__)
+  return 1;
+#else
+  return 0;
+#endif
 }
 
-static const char *parse_request(const char *buf, const char *buf_end,
-                                 const char **method, size_t *method_len,
-                                 const char **path, size_t *path_len,
-                                 int *minor_version, struct phr_header *headers,
-                                 size_t *num_headers, size_t max_headers,
-                                 int *ret) {
-  /* skip first empty line (some clients add CRLF after POST content) */
-  CHECK_EOF();
-  if (*buf == '\015') {
-    ++buf;
-    EXPECT_CHAR('\012');
-  } else if (*buf == '\012') {
-    ++buf;
-  }
+static const int phr_simd_level = phr_detect_simd_level();
 
-  /* parse request line */
-  ADVANCE_TOKEN(*method, *method_len);
-  ++buf;
-  ADVANCE_TOKEN(*path, *path_len);
-  ++buf;
-  if ((buf = parse_http_version(buf, buf_end, minor_version, ret)) == NULL) {
-    return NULL;
-  }
-  if (*buf == '\015') {
-    ++buf;
-    EXPECT_CHAR('\012');
-  } else if (*buf == '\012') {
-    ++buf;
-  } else {
-    *ret = -1;
-    return NULL;
-  }
+#define PHR_SIMD_LEVEL 0
+#define PHR_TARGET
+#define PHR_FN(name) name##_scalar
+#include "picohttpparser_scan.h"
+#undef PHR_SIMD_LEVEL
+#undef PHR_TARGET
+#undef PHR_FN
 
-  return parse_headers(buf, buf_end, headers, num_headers, max_headers, ret);
-}
+#ifdef PHR_HAS_SSE42
+#define PHR_SIMD_LEVEL 1
+#ifdef PHR_RUNTIME_DISPATCH
+#define PHR_TARGET __attribute__((target("sse4.2")))
+#else
+#define PHR_TARGET
+#endif
+#define PHR_FN(name) name##_sse42
+#include "picohttpparser_scan.h"
+#undef PHR_SIMD_LEVEL
+#undef PHR_TARGET
+#undef PHR_FN
+#endif
+
+#ifdef PHR_HAS_AVX2
+#define PHR_SIMD_LEVEL 2
+#ifdef PHR_RUNTIME_DISPATCH
+#define PHR_TARGET __attribute__((target("avx2")))
+#else
+#define PHR_TARGET
+#endif
+#define PHR_FN(name) name##_avx2
+#include "picohttpparser_scan.h"
+#undef PHR_SIMD_LEVEL
+#undef PHR_TARGET
+#undef PHR_FN
+#endif
+
+/* one branch per parse picks the copy built for this cpu */
+#if defined(PHR_HAS_AVX2) && defined(PHR_HAS_SSE42)
+#define PHR_DISPATCH(name, ...)                                                \
+  (phr_simd_level >= 2   ? name##_avx2(__VA_ARGS__)                            \
+   : phr_simd_level == 1 ? name##_sse42(__VA_ARGS__)                           \
+                         : name##_scalar(__VA_ARGS__))
+#elif defined(PHR_HAS_SSE42)
+#define PHR_DISPATCH(name, ...)                                                \
+  (phr_simd_level >= 1 ? name##_sse42(__VA_ARGS__) : name##_scalar(__VA_ARGS__))
+#else
+#define PHR_DISPATCH(name, ...) name##_scalar(__VA_ARGS__)
+#endif
 
 inline int phr_parse_request(const char *buf_start, size_t len,
                              const char **method, size_t *method_len,
@@ -465,51 +337,15 @@ inline int phr_parse_request(const char *buf_start, size_t len,
     return r;
   }
 
-  if ((buf = parse_request(buf + last_len, buf_end, method, method_len, path,
-                           path_len, minor_version, headers, num_headers,
-                           max_headers, &r)) == NULL) {
+  if ((buf = PHR_DISPATCH(parse_request, buf + last_len, buf_end, method,
+                          method_len, path, path_len, minor_version, headers,
+                          num_headers, max_headers, &r)) == NULL) {
     return r;
   }
 
   return (int)(buf - buf_start - last_len);
 }
 
-inline const char *parse_response(const char *buf, const char *buf_end,
-                                  int *minor_version, int *status,
-                                  const char **msg, size_t *msg_len,
-                                  struct phr_header *headers,
-                                  size_t *num_headers, size_t max_headers,
-                                  int *ret) {
-  /* parse "HTTP/1.x" */
-  if ((buf = parse_http_version(buf, buf_end, minor_version, ret)) == NULL) {
-    return NULL;
-  }
-  /* skip space */
-  if (*buf++ != ' ') {
-    *ret = -1;
-    return NULL;
-  }
-  /* parse status code, we want at least [:digit:][:digit:][:digit:]<other char>
-   * to try to parse */
-  if (buf_end - buf < 4) {
-    *ret = -2;
-    return NULL;
-  }
-  PARSE_INT_3(status);
-
-  /* skip space */
-  if (*buf++ != ' ') {
-    *ret = -1;
-    return NULL;
-  }
-  /* get message */
-  if ((buf = get_token_to_eol(buf, buf_end, msg, msg_len, ret)) == NULL) {
-    return NULL;
-  }
-
-  return parse_headers(buf, buf_end, headers, num_headers, max_headers, ret);
-}
-
 inline int phr_parse_response(const char *buf_start, size_t len,
                               int *minor_version, int *status, const char **msg,
                               size_t *msg_len, struct phr_header *headers,
@@ -530,8 +366,9 @@ inline int phr_parse_response(const char *buf_start, size_t len,
     return r;
   }
 
-  if ((buf = parse_response(buf, buf_end, minor_version, status, msg, msg_len,
-                            headers, num_headers, max_headers, &r)) == NULL) {
+  if ((buf = PHR_DISPATCH(parse_response, buf, buf_end, minor_version, status,
+                          msg, msg_len, headers, num_headers, max_headers,
+                          &r)) == NULL) {
     return r;
   }
 
@@ -553,8 +390,8 @@ inline int phr_parse_headers(const char *buf_start, size_t len,
     return r;
   }
 
-  if ((buf = parse_headers(buf, buf_end, headers, num_headers, max_headers,
-                           &r)) == NULL) {
+  if ((buf = PHR_DISPATCH(parse_headers, buf, buf_end, headers, num_headers,
+                          max_headers, &r)) == NULL) {
     return r;
   }
 
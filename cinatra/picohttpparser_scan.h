@@ -0,0 +1,296 @@
+/*
+ * The scanning half of picohttpparser.h, included once per instruction set
+ * it is built for. Before each inclusion picohttpparser.h defines
+ *   PHR_SIMD_LEVEL  0: scalar, 1: SSE4.2, 2: AVX2
+ *   PHR_TARGET      the matching target attribute, if any
+ *   PHR_FN(name)    the name of this copy of a function
+ * so every copy is compiled with its instruction set and inlines its own
+ * findchar_fast(). Token scans stop within a few bytes, cmpestri is the best
+ * fit for them at both SIMD levels; AVX2 only pays off for the long header
+ * values get_token_to_eol() walks over.
+ */
+
+#define findchar_fast PHR_FN(findchar_fast)
+#define get_token_to_eol PHR_FN(get_token_to_eol)
+#define parse_headers PHR_FN(parse_headers)
+#define parse_request PHR_FN(parse_request)
+#define parse_response PHR_FN(parse_response)
+
+PHR_TARGET
+static const char *findchar_fast(const char *buf, const char *buf_end,
+                                 const char *ranges, int ranges_size,
+                                 int *found) {
+  *found = 0;
+#if PHR_SIMD_LEVEL >= 1
+  if (likely(buf_end - buf >= 16)) {
+    __m128i ranges16 = _mm_loadu_si128((const __m128i *)ranges);
+
+    size_t left = (buf_end - buf) & ~15;
+    do {
+      __m128i b16 = _mm_loadu_si128((const __m128i *)buf);
+      int r = _mm_cmpestri(ranges16, ranges_size, b16, 16,
+                           _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES |
+                               _SIDD_UBYTE_OPS);
+      if (unlikely(r != 16)) {
+        buf += r;
+        *found = 1;
+        break;
+      }
+      buf += 16;
+      left -= 16;
+    } while (likely(left != 0));
+  }
+#else
+  /* suppress unused parameter warning */
+  (void)buf_end;
+  (void)ranges;
+  (void)ranges_size;
+#endif
+  return buf;
+}
+
+PHR_TARGET
+static const char *get_token_to_eol(const char *buf, const char *buf_end,
+                                    const char **token, size_t *token_len,
+                                    int *ret) {
+  const char *token_start = buf;
+
+#if PHR_SIMD_LEVEL
+  static const char ALIGNED(16) ranges1[] = "\0\010"
+                                /* allow HT */
+                                "\012\037"
+                                /* allow SP and up to but not including DEL */
+                                "\177\177"
+      /* allow chars w. MSB set */
+      ;
+  int found;
+#if PHR_SIMD_LEVEL >= 2
+  /* the same ranges, 32 bytes at a time: a control char is <= 037 but not
+   * HT, or DEL */
+  if (likely(buf_end - buf >= 32)) {
+    const __m256i ctl = _mm256_set1_epi8('\037');
+    const __m256i ht = _mm256_set1_epi8('\011');
+    const __m256i del = _mm256_set1_epi8('\177');
+    do {
+      __m256i b32 = _mm256_loadu_si256((const __m256i *)buf);
+      __m256i hit = _mm256_andnot_si256(
+          _mm256_cmpeq_epi8(b32, ht),
+          _mm256_cmpeq_epi8(_mm256_min_epu8(b32, ctl), b32));
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(b32, del));
+      unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+      if (mask != 0) {
+        buf += __builtin_ctz(mask);
+        goto FOUND_CTL;
+      }
+      buf += 32;
+    } while (likely(buf_end - buf >= 32));
+  }
+#endif
+  buf = findchar_fast(buf, buf_end, ranges1, sizeof(ranges1) - 1, &found);
+  if (found)
+    goto FOUND_CTL;
+#else
+  /* find non-printable char within the next 8 bytes, this is the hottest code;
+   * manually inlined */
+  while (likely(buf_end - buf >= 8)) {
+#define DOIT()                                                                 \
+  do {                                                                         \
+    if (unlikely(!IS_PRINTABLE_ASCII(*buf)))                                   \
+      goto NonPrintable;                                                       \
+    ++buf;                                                                     \
+  } while (0)
+    DOIT();
+    DOIT();
+    DOIT();
+    DOIT();
+    DOIT();
+    DOIT();
+    DOIT();
+    DOIT();
+#undef DOIT
+    continue;
+  NonPrintable:
+    if ((likely((unsigned char)*buf < '\040') && likely(*buf != '\011')) ||
+        unlikely(*buf == '\177')) {
+      goto FOUND_CTL;
+    }
+    ++buf;
+  }
+#endif
+  for (;; ++buf) {
+    CHECK_EOF();
+    if (unlikely(!IS_PRINTABLE_ASCII(*buf))) {
+      if ((likely((unsigned char)*buf < '\040') && likely(*buf != '\011')) ||
+          unlikely(*buf == '\177')) {
+        goto FOUND_CTL;
+      }
+    }
+  }
+FOUND_CTL:
+  if (likely(*buf == '\015')) {
+    ++buf;
+    EXPECT_CHAR('\012');
+    *token_len = buf - 2 - token_start;
+  } else if (*buf == '\012') {
+    *token_len = buf - token_start;
+    ++buf;
+  } else {
+    *ret = -1;
+    return NULL;
+  }
+  *token = token_start;
+
+  return buf;
+}
+
+PHR_TARGET
+static const char *parse_headers(const char *buf, const char *buf_end,
+                                 struct phr_header *headers,
+                                 size_t *num_headers, size_t max_headers,
+                                 int *ret) {
+  for (;; ++*num_headers) {
+    CHECK_EOF();
+    if (*buf == '\015') {
+      ++buf;
+      EXPECT_CHAR('\012');
+      break;
+    } else if (*buf == '\012') {
+      ++buf;
+      break;
+    }
+    if (*num_headers == max_headers) {
+      *ret = -1;
+      return NULL;
+    }
+    if (!(*num_headers != 0 && (*buf == ' ' || *buf == '\t'))) {
+      /* parsing name, but do not discard SP before colon, see
+       * http://www.mozilla.org/security/announce/2006/mfsa2006-33.html */
+      headers[*num_headers].name = buf;
+      static const char ALIGNED(16) ranges1[] =
+          "\x00 "  /* control chars and up to SP */
+          "\"\""   /* 0x22 */
+          "()"     /* 0x28,0x29 */
+          ",,"     /* 0x2c */
+          "//"     /* 0x2f */
+          ":@"     /* 0x3a-0x40 */
+          "[]"     /* 0x5b-0x5d */
+          "{\377"; /* 0x7b-0xff */
+      int found;
+      buf = findchar_fast(buf, buf_end, ranges1, sizeof(ranges1) - 1, &found);
+      if (!found) {
+        CHECK_EOF();
+      }
+      while (1) {
+        if (*buf == ':') {
+          break;
+        } else if (!token_char_map[(unsigned char)*buf]) {
+          *ret = -1;
+          return NULL;
+        }
+        ++buf;
+        CHECK_EOF();
+      }
+      if ((headers[*num_headers].name_len = buf - headers[*num_headers].name) ==
+          0) {
+        *ret = -1;
+        return NULL;
+      }
+      ++buf;
+      for (;; ++buf) {
+        CHECK_EOF();
+        if (!(*buf == ' ' || *buf == '\t')) {
+          break;
+        }
+      }
+    } else {
+      headers[*num_headers].name = NULL;
+      headers[*num_headers].name_len = 0;
+    }
+    if ((buf = get_token_to_eol(buf, buf_end, &headers[*num_headers].value,
+                                &headers[*num_headers].value_len, ret)) ==
+        NULL) {
+      return NULL;
+    }
+  }
+  return buf;
+}
+
+PHR_TARGET
+static const char *parse_request(const char *buf, const char *buf_end,
+                                 const char **method, size_t *method_len,
+                                 const char **path, size_t *path_len,
+                                 int *minor_version, struct phr_header *headers,
+                                 size_t *num_headers, size_t max_headers,
+                                 int *ret) {
+  /* skip first empty line (some clients add CRLF after POST content) */
+  CHECK_EOF();
+  if (*buf == '\015') {
+    ++buf;
+    EXPECT_CHAR('\012');
+  } else if (*buf == '\012') {
+    ++buf;
+  }
+
+  /* parse request line */
+  ADVANCE_TOKEN(*method, *method_len);
+  ++buf;
+  ADVANCE_TOKEN(*path, *path_len);
+  ++buf;
+  if ((buf = parse_http_version(buf, buf_end, minor_version, ret)) == NULL) {
+    return NULL;
+  }
+  if (*buf == '\015') {
+    ++buf;
+    EXPECT_CHAR('\012');
+  } else if (*buf == '\012') {
+    ++buf;
+  } else {
+    *ret = -1;
+    return NULL;
+  }
+
+  return parse_headers(buf, buf_end, headers, num_headers, max_headers, ret);
+}
+
+PHR_TARGET
+static const char *parse_response(const char *buf, const char *buf_end,
+                                  int *minor_version, int *status,
+                                  const char **msg, size_t *msg_len,
+                                  struct phr_header *headers,
+                                  size_t *num_headers, size_t max_headers,
+                                  int *ret) {
+  /* parse "HTTP/1.x" */
+  if ((buf = parse_http_version(buf, buf_end, minor_version, ret)) == NULL) {
+    return NULL;
+  }
+  /* skip space */
+  if (*buf++ != ' ') {
+    *ret = -1;
+    return NULL;
+  }
+  /* parse status code, we want at least [:digit:][:digit:][:digit:]<other char>
+   * to try to parse */
+  if (buf_end - buf < 4) {
+    *ret = -2;
+    return NULL;
+  }
+  PARSE_INT_3(status);
+
+  /* skip space */
+  if (*buf++ != ' ') {
+    *ret = -1;
+    return NULL;
+  }
+  /* get message */
+  if ((buf = get_token_to_eol(buf, buf_end, msg, msg_len, ret)) == NULL) {
+    return NULL;
+  }
+
+  return parse_headers(buf, buf_end, headers, num_headers, max_headers, ret);
+}
+
+#undef findchar_fast
+#undef get_token_to_eol
+#undef parse_headers
+#undef parse_request
+#undef parse_response
@@ -0,0 +1,67 @@
+#pragma once
+#include <array>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cinatra {
+// Query or form parameters in the order they were sent, duplicates included.
+// The first inline_capacity pairs live in the object itself, so the request,
+// which is reused for every request on a connection, parses typical query
+// strings without allocating. Lookups are linear, at these sizes that beats
+// any tree or hash.
+class query_params {
+public:
+  using value_type = std::pair<std::string_view, std::string_view>;
+  using const_iterator = const value_type *;
+  static constexpr size_t inline_capacity = 16;
+
+  void emplace(std::string_view key, std::string_view val) {
+    if (size_ < inline_capacity) {
+      inline_[size_++] = {key, val};
+      return;
+    }
+
+    if (heap_.empty())
+      heap_.assign(inline_.begin(), inline_.end());
+    heap_.emplace_back(key, val);
+    size_++;
+  }
+
+  void clear() {
+    size_ = 0;
+    heap_.clear();
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const value_type *data() const {
+    return heap_.empty() ? inline_.data() : heap_.data();
+  }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+  const value_type &operator[](size_t n) const { return data()[n]; }
+
+  // the first parameter called key
+  const_iterator find(std::string_view key) const {
+    for (auto it = begin(); it != end(); ++it) {
+      if (it->first == key)
+        return it;
+    }
+    return end();
+  }
+
+  size_t count(std::string_view key) const {
+    size_t n = 0;
+    for (auto &pair : *this)
+      n += pair.first == key;
+    return n;
+  }
+
+private:
+  std::array<value_type, inline_capacity> inline_;
+  std::vector<value_type> heap_;
+  size_t size_ = 0;
+};
+} // namespace cinatra
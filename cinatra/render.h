@@ -1,17 +1,25 @@
 #pragma once
 
 #include "nlohmann_json.hpp"
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <charconv>
 #include <exception>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -758,19 +766,619 @@ static void to_render_data(const nlohmann::json &json,
   }
 }
 
+namespace internal {
+// same output as object::str() on the to_render_data() conversion
+template <typename T> static void append_value(T value, std::string &out) {
+  char buf[96];
+  if constexpr (std::is_same_v<T, bool>) {
+    out.push_back(value ? '1' : '0');
+    return;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    auto r = std::to_chars(buf, buf + sizeof(buf), (double)value,
+                           std::chars_format::general, 64);
+    out.append(buf, r.ptr);
+  } else {
+    static_assert(std::is_integral_v<T>);
+    auto r = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, r.ptr);
+  }
+}
+
+// false for arrays and objects
+static bool append_value(const json &value, std::string &out) {
+  switch (value.type()) {
+  case json::value_t::string:
+    out.append(value.get_ref<const std::string &>());
+    return true;
+  case json::value_t::number_integer:
+    append_value(value.get<int64_t>(), out);
+    return true;
+  case json::value_t::number_unsigned:
+    append_value(value.get<uint64_t>(), out);
+    return true;
+  case json::value_t::number_float:
+    append_value(value.get<double>(), out);
+    return true;
+  case json::value_t::boolean:
+    append_value(value.get<bool>(), out);
+    return true;
+  case json::value_t::null:
+    out.append("null");
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace internal
+
+// A template parsed once into a flat list of ops and rendered straight from
+// nlohmann::json, same syntax as parse(). $include and $inline files are read
+// at compile time; compile_file() caches by path and the mtimes of every file
+// the template was built from.
+class compiled_template {
+public:
+  using file_list =
+      std::vector<std::pair<std::string, std::filesystem::file_time_type>>;
+
+  // throws parse_error
+  static std::shared_ptr<const compiled_template>
+  compile(std::string_view tpl) {
+    auto t = std::shared_ptr<compiled_template>(new compiled_template);
+    t->source_ = tpl;
+    compiler c(*t);
+    c.run();
+    return t;
+  }
+
+  // throws parse_error, or std::runtime_error if a file can't be opened
+  static std::shared_ptr<const compiled_template>
+  compile_file(const std::string &path) {
+    auto &cache = template_cache();
+    {
+      std::lock_guard<std::mutex> lock(cache.mtx);
+      auto it = cache.templates.find(path);
+      if (it != cache.templates.end() && it->second->up_to_date()) {
+        return it->second;
+      }
+    }
+
+    auto t = compile_file_uncached(path);
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    cache.templates.insert_or_assign(path, t);
+    return t;
+  }
+
+  // appends to out, throws parse_error
+  void render(const json &data, std::string &out) const {
+    std::vector<const json *> scope(max_depth_);
+    run(0, ops_.size(), data, scope, out);
+  }
+
+  std::string render(const json &data) const {
+    std::string out;
+    out.reserve(size_hint_.load(std::memory_order_relaxed));
+    render(data, out);
+    size_hint_.store(out.size(), std::memory_order_relaxed);
+    return out;
+  }
+
+  const file_list &files() const { return files_; }
+
+  bool up_to_date() const {
+    std::error_code ec;
+    for (auto &[name, time] : files_) {
+      if (std::filesystem::last_write_time(name, ec) != time || ec)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  struct op {
+    enum kind_t : uint8_t {
+      text,    // text_[offset, offset + size)
+      value,   // ${path}
+      loop,    // $for scope[slot] in path, body up to next
+      branch,  // $if/$elseif, jumps to next when false
+      jump,    // end of a taken branch
+      include, // children_[child]
+    };
+    kind_t kind;
+    uint32_t line = 0;
+    uint32_t path = 0;
+    uint32_t slot = 0;
+    uint32_t next = 0;
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    int compare = -1; // $if path == literals_[compare]
+  };
+
+  // a variable: head is a loop variable (slot >= 0) or a key of the data
+  struct path_t {
+    int slot = -1;
+    std::string head;
+    std::vector<std::string> members;
+  };
+
+  struct cache_t {
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_ptr<const compiled_template>>
+        templates;
+  };
+
+  static cache_t &template_cache() {
+    static cache_t cache;
+    return cache;
+  }
+
+  compiled_template() = default;
+
+  static std::string read_file(const std::string &path,
+                               std::filesystem::file_time_type &time) {
+    std::error_code ec;
+    time = std::filesystem::last_write_time(path, ec);
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("html template file can not open");
+    }
+    std::stringstream buff;
+    buff << file.rdbuf();
+    return buff.str();
+  }
+
+  static std::shared_ptr<compiled_template>
+  compile_file_uncached(const std::string &path) {
+    std::filesystem::file_time_type time;
+    auto tpl = read_file(path, time);
+    auto t = std::shared_ptr<compiled_template>(new compiled_template);
+    t->source_ = std::move(tpl);
+    t->files_.emplace_back(path, time);
+    compiler c(*t);
+    c.run();
+    return t;
+  }
+
+  class compiler {
+  public:
+    explicit compiler(compiled_template &t) : t_(t), src_(t.source_) {}
+
+    void run() {
+      block(false);
+      t_.max_depth_ = max_depth_;
+    }
+
+  private:
+    bool eof() const { return pos_ == src_.size(); }
+
+    char peek() const {
+      if (eof())
+        throw error("Do not access end of string at peek()");
+      return src_[pos_];
+    }
+
+    bool starts_with(std::string_view s) const {
+      return src_.substr(pos_).starts_with(s);
+    }
+
+    void read() {
+      if (peek() == '\n')
+        line_++;
+      pos_++;
+    }
+
+    void skip_whitespace() {
+      while (!eof() && (unsigned char)src_[pos_] <= 32)
+        read();
+    }
+
+    void eat(std::string_view s) {
+      for (char c : s) {
+        if (peek() != c) {
+          throw error(std::string("Unexpected character ") + peek() +
+                      ". Expected character is " + c);
+        }
+        read();
+      }
+    }
+
+    template <class F> std::string_view read_while(F f) {
+      size_t first = pos_;
+      while (!eof() && f(src_[pos_]))
+        read();
+      return src_.substr(first, pos_ - first);
+    }
+
+    std::string_view read_ident() {
+      skip_whitespace();
+      return read_while([](char c) {
+        return (unsigned char)c > 32 && c != '{' && c != '}';
+      });
+    }
+
+    std::string read_variable() {
+      auto v = read_while([](char c) {
+        return (unsigned char)c > 32 && c != '.' && c != '{' && c != '}';
+      });
+      if (v.empty())
+        throw error("Did not find variable at read_variable().");
+      return std::string(v);
+    }
+
+    uint32_t read_path() {
+      skip_whitespace();
+      path_t path;
+      path.head = read_variable();
+      while (!eof() && src_[pos_] == '.') {
+        read();
+        path.members.push_back(read_variable());
+      }
+      // loop variables shadow the data, the innermost one wins
+      for (size_t i = loop_vars_.size(); i-- > 0;) {
+        if (loop_vars_[i] == path.head) {
+          path.slot = (int)i;
+          break;
+        }
+      }
+      t_.paths_.push_back(std::move(path));
+      return (uint32_t)t_.paths_.size() - 1;
+    }
+
+    std::string read_file_name() {
+      skip_whitespace();
+      auto name = read_while(
+          [](char c) { return (unsigned char)c > 32 && c != '}'; });
+      if (name.empty())
+        throw error("Did not find variable at read_variable().");
+      return std::string(name);
+    }
+
+    void text(std::string_view s) {
+      if (s.empty())
+        return;
+      auto &ops = t_.ops_;
+      if (!ops.empty() && ops.back().kind == op::text &&
+          ops.back().offset + ops.back().size == t_.text_.size() &&
+          jump_targets_ != ops.size()) {
+        ops.back().size += (uint32_t)s.size();
+      } else {
+        ops.push_back(
+            {op::text, line_, 0, 0, 0, (uint32_t)t_.text_.size(),
+             (uint32_t)s.size()});
+      }
+      t_.text_.append(s);
+    }
+
+    size_t add(op o) {
+      o.line = o.line ? o.line : line_;
+      t_.ops_.push_back(o);
+      return t_.ops_.size() - 1;
+    }
+
+    // the ops emitted so far may be a jump target, don't merge text into them
+    void mark_target() { jump_targets_ = t_.ops_.size(); }
+
+    // returns at "}}" (not consumed) when nested, at the end otherwise
+    void block(bool nested) {
+      while (!eof()) {
+        text(read_while([](char c) { return c != '}' && c != '$'; }));
+        if (eof())
+          break;
+
+        if (src_[pos_] == '}') {
+          if (starts_with("}}")) {
+            // a stray "}}" ends the template, like parse()
+            if (!nested)
+              stopped_ = true;
+            return;
+          }
+          read();
+          text("}");
+          continue;
+        }
+
+        read(); // $
+        char c = peek();
+        if (c == '$') {
+          read();
+          text("$");
+        } else if (c == '#') {
+          read_while([](char c) { return c != '\n'; });
+        } else if (c == '{') {
+          read();
+          if (peek() == '{') {
+            read();
+            text("{{");
+          } else {
+            uint32_t path = read_path();
+            skip_whitespace();
+            eat("}");
+            add({op::value, 0, path});
+          }
+        } else if (c == '}') {
+          read();
+          if (peek() != '}') {
+            throw error(std::string("Unexpected character '") + peek() +
+                        "'. It must be '}' after \"$}\"");
+          }
+          read();
+          text("}}");
+        } else {
+          command();
+        }
+        if (stopped_)
+          return;
+      }
+      if (nested)
+        throw error("End of string suddenly at read_while()");
+    }
+
+    void nested_block() {
+      skip_whitespace();
+      eat("{{");
+      block(true);
+      eat("}}");
+    }
+
+    void command() {
+      auto command = read_ident();
+      if (command == "for") {
+        // $for x in xs {{ <block> }}
+        std::string var(read_ident());
+        auto in = read_ident();
+        if (in != "in") {
+          throw error("Unexpected string \"" + std::string(in) +
+                      "\". It must be \"in\"");
+        }
+        uint32_t path = read_path();
+        size_t loop = add({op::loop, 0, path, (uint32_t)loop_vars_.size()});
+        loop_vars_.push_back(std::move(var));
+        max_depth_ = std::max(max_depth_, loop_vars_.size());
+        nested_block();
+        loop_vars_.pop_back();
+        t_.ops_[loop].next = (uint32_t)t_.ops_.size();
+        mark_target();
+      } else if (command == "if") {
+        conditional();
+      } else if (command == "inline") {
+        // $inline {{ file }}, copied as is
+        skip_whitespace();
+        eat("{{");
+        auto name = read_file_name();
+        std::filesystem::file_time_type time;
+        auto content = read_file(name, time);
+        t_.files_.emplace_back(name, time);
+        text(content);
+        skip_whitespace();
+        eat("}}");
+      } else if (command == "include") {
+        // $include {{ file }}, a template of its own that sees the data but
+        // not the loop variables around it
+        skip_whitespace();
+        eat("{{");
+        auto name = read_file_name();
+        auto child = compile_file_uncached(name);
+        t_.files_.insert(t_.files_.end(), child->files_.begin(),
+                         child->files_.end());
+        t_.children_.push_back(std::move(child));
+        op o{op::include};
+        o.next = (uint32_t)t_.children_.size() - 1;
+        add(o);
+        mark_target();
+        skip_whitespace();
+        eat("}}");
+      } else {
+        throw error("Unexpected command " + std::string(command) +
+                    ". It must be \"for\" or \"if\"");
+      }
+    }
+
+    // $if x {{ <block> }}
+    // $elseif y {{ <block> }}
+    // $else {{ <block> }}
+    // $if x.y == value {{ <block> }}
+    void conditional() {
+      std::vector<size_t> jumps;
+      size_t branch = add_branch();
+      while (true) {
+        nested_block();
+        size_t save_pos = pos_;
+        uint32_t save_line = line_;
+        skip_whitespace();
+        std::string_view command;
+        if (!eof() && src_[pos_] == '$') {
+          read();
+          command = read_ident();
+        }
+        if (command != "elseif" && command != "else") {
+          pos_ = save_pos;
+          line_ = save_line;
+          break;
+        }
+
+        jumps.push_back(add({op::jump}));
+        t_.ops_[branch].next = (uint32_t)t_.ops_.size();
+        mark_target();
+        if (command == "else") {
+          branch = SIZE_MAX;
+          nested_block();
+          break;
+        }
+        branch = add_branch();
+      }
+
+      uint32_t end = (uint32_t)t_.ops_.size();
+      if (branch != SIZE_MAX)
+        t_.ops_[branch].next = end;
+      for (auto jump : jumps) {
+        t_.ops_[jump].next = end;
+      }
+      mark_target();
+    }
+
+    size_t add_branch() {
+      op o{op::branch};
+      o.path = read_path();
+      skip_whitespace();
+      if (starts_with("==")) {
+        eat("==");
+        auto literal = read_while([&](char) { return !starts_with("{{"); });
+        while (!literal.empty() && (unsigned char)literal.front() <= 32)
+          literal.remove_prefix(1);
+        while (!literal.empty() && (unsigned char)literal.back() <= 32)
+          literal.remove_suffix(1);
+        t_.literals_.emplace_back(literal);
+        o.compare = (int)t_.literals_.size() - 1;
+      }
+      return add(o);
+    }
+
+    parse_error error(std::string message) const {
+      size_t begin = src_.rfind('\n', pos_ == 0 ? 0 : pos_ - 1);
+      begin = begin == std::string_view::npos || begin >= pos_ ? 0 : begin + 1;
+      size_t end = src_.find('\n', pos_);
+      if (end == std::string_view::npos)
+        end = src_.size();
+      return parse_error(std::move(message), (int)line_,
+                         std::string(src_.substr(begin, pos_ - begin)),
+                         std::string(src_.substr(pos_, end - pos_)));
+    }
+
+    compiled_template &t_;
+    std::string_view src_;
+    size_t pos_ = 0;
+    uint32_t line_ = 1;
+    std::vector<std::string> loop_vars_;
+    size_t max_depth_ = 0;
+    size_t jump_targets_ = 0;
+    bool stopped_ = false;
+  };
+
+  parse_error error(uint32_t line, std::string message) const {
+    std::string_view src = source_;
+    size_t begin = 0;
+    for (uint32_t i = 1; i < line && begin != std::string_view::npos; i++) {
+      begin = src.find('\n', begin);
+      if (begin != std::string_view::npos)
+        begin++;
+    }
+    std::string text;
+    if (begin != std::string_view::npos) {
+      text = src.substr(begin, src.find('\n', begin) - begin);
+    }
+    return parse_error(std::move(message), (int)line, std::move(text), "");
+  }
+
+  const json &resolve(const op &o, const json &data,
+                      const std::vector<const json *> &scope) const {
+    auto &path = paths_[o.path];
+    const json *value;
+    if (path.slot >= 0) {
+      value = scope[path.slot];
+    } else {
+      auto it = data.is_object() ? data.find(path.head) : data.end();
+      if (it == data.end())
+        throw error(o.line, "Variable \"" + path.head + "\" is not found");
+      value = &*it;
+    }
+
+    for (auto &member : path.members) {
+      if (!value->is_object())
+        throw error(o.line, "This value does not have operator[]().");
+      auto it = value->find(member);
+      if (it == value->end())
+        throw error(o.line, "Variable \"" + member + "\" is not found");
+      value = &*it;
+    }
+    return *value;
+  }
+
+  void append(const op &o, const json &value, std::string &out) const {
+    if (!internal::append_value(value, out))
+      throw error(o.line, "This value does not have operator<<().");
+  }
+
+  bool test(const op &o, const json &value) const {
+    if (o.compare >= 0) {
+      auto &literal = literals_[o.compare];
+      if (literal == "true" || literal == "false")
+        return test(op{op::branch, o.line}, value) == (literal == "true");
+      if (value.is_string())
+        return value.get_ref<const std::string &>() == literal;
+      std::string str;
+      append(o, value, str);
+      return str == literal;
+    }
+
+    switch (value.type()) {
+    case json::value_t::boolean:
+      return value.get<bool>();
+    case json::value_t::number_integer:
+    case json::value_t::number_unsigned:
+    case json::value_t::number_float:
+      return value.get<double>() != 0;
+    default:
+      throw error(o.line, "This value does not evaluate.");
+    }
+  }
+
+  void run(size_t first, size_t last, const json &data,
+           std::vector<const json *> &scope, std::string &out) const {
+    for (size_t i = first; i < last;) {
+      auto &o = ops_[i];
+      switch (o.kind) {
+      case op::text:
+        out.append(text_, o.offset, o.size);
+        i++;
+        break;
+      case op::value:
+        append(o, resolve(o, data, scope), out);
+        i++;
+        break;
+      case op::loop: {
+        auto &list = resolve(o, data, scope);
+        if (!list.is_array() && !list.is_object())
+          throw error(o.line, "This value does not have begin() or end().");
+        for (auto &item : list) {
+          scope[o.slot] = &item;
+          run(i + 1, o.next, data, scope, out);
+        }
+        i = o.next;
+        break;
+      }
+      case op::branch:
+        i = test(o, resolve(o, data, scope)) ? i + 1 : o.next;
+        break;
+      case op::jump:
+        i = o.next;
+        break;
+      case op::include:
+        children_[o.next]->render(data, out);
+        i++;
+        break;
+      }
+    }
+  }
+
+  std::string source_;
+  std::string text_;
+  std::vector<op> ops_;
+  std::vector<path_t> paths_;
+  std::vector<std::string> literals_;
+  std::vector<std::shared_ptr<const compiled_template>> children_;
+  file_list files_;
+  size_t max_depth_ = 0;
+  mutable std::atomic<size_t> size_hint_ = 0;
+};
+
+// renders a cached compiled template, appending to out
+static void render_file(const std::string &tpl_filepath,
+                        const nlohmann::json &data, std::string &out) {
+  compiled_template::compile_file(tpl_filepath)->render(data, out);
+}
+
 static std::string render_file(const std::string &tpl_filepath,
                                const nlohmann::json &data) {
-  std::stringstream buff;
-  std::ifstream file(tpl_filepath);
-  if (!file.is_open()) {
-    throw std::runtime_error("html template file can not open");
-  }
-  buff << file.rdbuf();
-  std::stringstream result;
-  std::map<std::string, object> render_map;
-  to_render_data(data, render_map);
-  render::parse(buff.str(), render_map, internal::from_ios(result));
-  return result.str();
+  return compiled_template::compile_file(tpl_filepath)->render(data);
 }
 
 static std::string render_file(const std::string &tpl_filepath) {
@@ -785,11 +1393,7 @@ static std::string render_file(const std::string &tpl_filepath) {
 
 static std::string render_string(const std::string &tpl_str,
                                  const nlohmann::json &data) {
-  std::stringstream result;
-  std::map<std::string, object> render_map;
-  to_render_data(data, render_map);
-  render::parse(tpl_str, render_map, internal::from_ios(result));
-  return result.str();
+  return compiled_template::compile(tpl_str)->render(data);
 }
 
 } // namespace render
@@ -3,12 +3,15 @@
 #include "picohttpparser.h"
 #include "utils.hpp"
 #include <any>
+#include <charconv>
 #include <fstream>
 #ifdef CINATRA_ENABLE_GZIP
 #include "gzip.hpp"
 #endif
 #include "define.h"
+#include "header_index.hpp"
 #include "mime_types.hpp"
+#include "query_params.hpp"
 #include "response.hpp"
 #include "session.hpp"
 #include "session_manager.hpp"
@@ -90,6 +93,7 @@ public:
     if (header_len_ < 0)
       return header_len_;
 
+    index_headers();
     if (!check_request()) {
       return -1;
     }
@@ -107,11 +111,6 @@ public:
       set_body_len(atoll(header_value.data()));
     }
 
-    auto cookie = get_header_value("cookie");
-    if (!cookie.empty()) {
-      cookie_str_ = std::string(cookie.data(), cookie.length());
-    }
-
     // parse url and queries
     raw_url_ = {url_, url_len_};
     size_t npos = raw_url_.find('/');
@@ -120,8 +119,8 @@ public:
 
     size_t pos = raw_url_.find('?');
     if (pos != std::string_view::npos) {
-      queries_ = parse_query(
-          std::string_view{raw_url_}.substr(pos + 1, url_len_ - pos - 1));
+      query_str_.assign(raw_url_, pos + 1);
+      parse_query(query_str_, queries_);
       url_len_ = pos;
     }
 
@@ -225,16 +224,17 @@ public:
     is_chunked_ = false;
     state_ = data_proc_state::data_begin;
     part_data_ = {};
-    utf8_character_params_.clear();
     utf8_character_pathinfo_params_.clear();
     queries_.clear();
-    cookie_str_.clear();
+    cookies_parsed_ = false;
     form_url_map_.clear();
     multipart_form_map_.clear();
     is_range_resource_ = false;
     range_start_pos_ = 0;
+    range_end_pos_ = -1;
     static_resource_file_size_ = 0;
     copy_headers_.clear();
+    header_index_.clear();
   }
 
   void fit_size() {
@@ -290,6 +290,22 @@ public:
     return left_body_len_ > size ? size : left_body_len_;
   }
 
+  // takes a request that did not come off the socket, e.g. one rebuilt from
+  // an HTTP/2 stream, to be parsed with parse_header(0)
+  bool load(std::string_view head, std::string_view body) {
+    size_t size = head.size() + body.size();
+    if (size > MaxSize)
+      return false;
+
+    if (buf_.size() < size)
+      buf_.resize(size);
+    memcpy(buf_.data(), head.data(), head.size());
+    if (!body.empty())
+      memcpy(buf_.data() + head.size(), body.data(), body.size());
+    cur_size_ = size;
+    return true;
+  }
+
   void set_current_size(size_t size) {
     cur_size_ = size;
     if (size == 0) {
@@ -299,29 +315,22 @@ public:
 
   std::string_view get_header_value(std::string_view key) const {
     if (copy_headers_.empty()) {
-      for (size_t i = 0; i < num_headers_; i++) {
-        if (iequal(headers_[i].name, headers_[i].name_len, key.data(),
-                   key.length()))
-          return std::string_view(headers_[i].value, headers_[i].value_len);
-      }
+      int i = header_index_.find(key, [this](size_t i) {
+        return std::string_view(headers_[i].name, headers_[i].name_len);
+      });
+      if (i < 0)
+        return {};
 
-      return {};
+      return std::string_view(headers_[i].value, headers_[i].value_len);
     }
 
-    auto it = std::find_if(
-        copy_headers_.begin(), copy_headers_.end(), [key](auto &pair) {
-          if (iequal(pair.first.data(), pair.first.size(), key.data())) {
-            return true;
-          }
-
-          return false;
-        });
-
-    if (it != copy_headers_.end()) {
-      return (*it).second;
-    }
+    int i = header_index_.find(key, [this](size_t i) {
+      return std::string_view(copy_headers_[i].first);
+    });
+    if (i < 0)
+      return {};
 
-    return {};
+    return copy_headers_[i].second;
   }
 
   std::pair<phr_header *, size_t> get_headers() {
@@ -426,43 +435,34 @@ public:
     }
   }
 
-  std::map<std::string_view, std::string_view>
-  parse_query(std::string_view str) {
-    std::map<std::string_view, std::string_view> query;
-    std::string_view key;
-    std::string_view val;
-    size_t pos = 0;
+  // splits str into key=value pairs and percent-decodes them in place, the
+  // views in params point into str
+  static void parse_query(std::string &str, query_params &params) {
+    params.clear();
+    char *data = str.data();
     size_t length = str.length();
-    for (size_t i = 0; i < length; i++) {
-      char c = str[i];
-      if (c == '=') {
-        key = {&str[pos], i - pos};
-        key = trim(key);
-        pos = i + 1;
-      } else if (c == '&') {
-        val = {&str[pos], i - pos};
-        val = trim(val);
-        pos = i + 1;
-        // if (is_form_url_encode(key)) {
-        //	auto s = form_urldecode(key);
-        //}
-        query.emplace(key, val);
-      }
-    }
-
-    if (pos == 0) {
-      return {};
-    }
-
-    if ((length - pos) > 0) {
-      val = {&str[pos], length - pos};
+    size_t pos = 0;
+    while (pos < length) {
+      size_t end = str.find('&', pos);
+      if (end == std::string::npos)
+        end = length;
+
+      std::string_view pair(data + pos, end - pos);
+      size_t eq = pair.find('=');
+      if (eq == std::string_view::npos)
+        eq = pair.size();
+      std::string_view key = pair.substr(0, eq);
+      std::string_view val = pair.substr(std::min(eq + 1, pair.size()));
+      key = trim(key);
       val = trim(val);
-      query.emplace(key, val);
-    } else if ((length - pos) == 0) {
-      query.emplace(key, "");
+      if (!key.empty()) {
+        char *k = data + (key.data() - data);
+        char *v = data + (val.data() - data);
+        params.emplace({k, code_utils::url_decode_in_place(k, key.size())},
+                       {v, code_utils::url_decode_in_place(v, val.size())});
+      }
+      pos = end + 1;
     }
-
-    return query;
   }
 
   bool parse_form_urlencoded() {
@@ -475,7 +475,8 @@ public:
     }
 #endif
     auto body_str = body();
-    form_url_map_ = parse_query(body_str);
+    form_str_.assign(body_str.data(), body_str.size());
+    parse_query(form_str_, form_url_map_);
     if (form_url_map_.empty())
       return false;
 
@@ -535,9 +536,7 @@ public:
     return mime;
   }
 
-  std::map<std::string_view, std::string_view> get_form_url_map() const {
-    return form_url_map_;
-  }
+  const query_params &get_form_url_map() const { return form_url_map_; }
 
   void set_state(data_proc_state state) { state_ = state; }
 
@@ -567,27 +566,22 @@ public:
 
   content_type get_content_type() const { return http_type_; }
 
-  const std::map<std::string_view, std::string_view> &queries() const {
-    return queries_;
-  }
+  const query_params &queries() const { return queries_; }
 
   std::string_view get_query_value(size_t n) {
-    auto get_val = [&n](auto &map) {
-      auto it = map.begin();
-      std::advance(it, n);
-      return it->second;
-    };
-
     if (n >= queries_.size()) {
+      n -= queries_.size();
       if (n >= form_url_map_.size())
         return {};
 
-      return get_val(form_url_map_);
+      return form_url_map_[n].second;
     } else {
-      return get_val(queries_);
+      return queries_[n].second;
     }
   }
 
+  // throws std::logic_error if the value is missing and
+  // std::invalid_argument if it is not a T
   template <typename T> T get_query_value(std::string_view key) {
     static_assert(std::is_arithmetic_v<T>);
     auto val = get_query_value(key);
@@ -595,61 +589,28 @@ public:
       throw std::logic_error("empty value");
     }
 
-    if constexpr (std::is_same_v<T, int32_t> || std::is_same_v<T, uint32_t> ||
-                  std::is_same_v<T, bool> || std::is_same_v<T, char> ||
-                  std::is_same_v<T, short>) {
-      int r = std::atoi(val.data());
-      if (val[0] != '0' && r == 0) {
-        throw std::invalid_argument(std::string(val) + ": is not an integer");
-      }
-      return r;
-    } else if constexpr (std::is_same_v<T, int64_t> ||
-                         std::is_same_v<T, uint64_t>) {
-      auto r = std::atoll(val.data());
-      if (val[0] != '0' && r == 0) {
-        throw std::invalid_argument(std::string(val) + ": is not an integer");
-      }
-      return r;
-    } else if constexpr (std::is_floating_point_v<T>) {
-      char *end;
-      auto f = strtof(val.data(), &end);
-      if (val.back() != *(end - 1)) {
-        throw std::invalid_argument(std::string(val) + ": is not a float");
-      }
-      return f;
+    if constexpr (std::is_same_v<T, bool>) {
+      if (val == "true")
+        return true;
+      if (val == "false")
+        return false;
+      return get_query_value_as<long long>(val) != 0;
     } else {
-      throw std::invalid_argument("not support the value type");
+      return get_query_value_as<T>(val);
     }
   }
 
+  // the first value of key in the query string, then in the form body
   std::string_view get_query_value(std::string_view key) {
-    auto url = get_url();
-    url = url.length() > 1 && url.back() == '/'
-              ? url.substr(0, url.length() - 1)
-              : url;
-    std::string map_key = std::string(url.data(), url.size()) +
-                          std::string(key.data(), key.size());
     auto it = queries_.find(key);
-    if (it == queries_.end()) {
-      auto itf = form_url_map_.find(key);
-      if (itf == form_url_map_.end())
-        return {};
+    if (it != queries_.end())
+      return it->second;
 
-      if (code_utils::is_url_encode(itf->second)) {
-        auto ret = utf8_character_params_.emplace(
-            map_key, code_utils::get_string_by_urldecode(itf->second));
-        return std::string_view(ret.first->second.data(),
-                                ret.first->second.size());
-      }
+    auto itf = form_url_map_.find(key);
+    if (itf != form_url_map_.end())
       return itf->second;
-    }
-    if (code_utils::is_url_encode(it->second)) {
-      auto ret = utf8_character_params_.emplace(
-          map_key, code_utils::get_string_by_urldecode(it->second));
-      return std::string_view(ret.first->second.data(),
-                              ret.first->second.size());
-    }
-    return it->second;
+
+    return {};
   }
 
   bool uncompress(std::string_view str) {
@@ -709,19 +670,32 @@ public:
     return nullptr;
   }
 
-  std::map<std::string_view, std::string_view> get_cookies() const {
-    // auto cookies_str = get_header_value("cookie");
-    auto cookies = get_cookies_map(cookie_str_);
-    return cookies;
+  // the cookies of the Cookie header, parsed on first use; the views point
+  // into the request buffer
+  const query_params &get_cookies() const {
+    parse_cookies();
+    return cookies_;
+  }
+
+  std::string_view get_cookie_value(std::string_view name) const {
+    parse_cookies();
+    if (name == CSESSIONID) {
+      if (session_cookie_ < 0)
+        return {};
+
+      return cookies_[session_cookie_].second;
+    }
+
+    auto it = cookies_.find(name);
+    return it == cookies_.end() ? std::string_view{} : it->second;
   }
 
   std::weak_ptr<session> get_session(const std::string &name) {
-    auto cookies = get_cookies();
-    auto iter = cookies.find(name);
+    auto value = get_cookie_value(name);
     std::weak_ptr<session> ref;
-    if (iter != cookies.end()) {
+    if (!value.empty()) {
       ref = session_manager::get().get_session(
-          std::string(iter->second.data(), iter->second.length()));
+          std::string(value.data(), value.length()));
     }
     res_.set_session(ref);
     return ref;
@@ -740,7 +714,19 @@ public:
       auto pos_str =
           range_header.substr(l_str_pos + 1, r_str_pos - l_str_pos - 1);
       range_start_pos_ = std::atoll(pos_str.data());
+      auto end_str = range_header.substr(r_str_pos + 1);
+      range_end_pos_ = end_str.empty() ? -1 : std::atoll(end_str.data());
+    }
+  }
+
+  void set_range_end_pos(std::int64_t pos) { range_end_pos_ = pos; }
+
+  // -1 means the range is open-ended, "bytes=100-"
+  std::int64_t get_range_end_pos() const {
+    if (is_range_resource_) {
+      return range_end_pos_;
     }
+    return -1;
   }
 
   std::int64_t get_range_start_pos() const {
@@ -808,14 +794,69 @@ private:
       copy_headers_.emplace_back("filename", std::move(filename));
     }
 
-    if (header_len_ < 0)
+    if (header_len_ < 0) {
+      index_headers();
       return;
+    }
 
     for (size_t i = 0; i < num_headers_; i++) {
       copy_headers_.emplace_back(
           std::string(headers_[i].name, headers_[i].name_len),
           std::string(headers_[i].value, headers_[i].value_len));
     }
+    index_headers();
+  }
+
+  // lookups go to copy_headers_ once the headers were copied out of buf_
+  void index_headers() {
+    cookies_parsed_ = false;
+    if (copy_headers_.empty()) {
+      header_index_.build(num_headers_, [this](size_t i) {
+        return std::string_view(headers_[i].name, headers_[i].name_len);
+      });
+    } else {
+      header_index_.build(copy_headers_.size(), [this](size_t i) {
+        return std::string_view(copy_headers_[i].first);
+      });
+    }
+  }
+
+  template <typename T> static T get_query_value_as(std::string_view val) {
+    T r{};
+    auto [ptr, ec] = std::from_chars(val.data(), val.data() + val.size(), r);
+    if (ec != std::errc{} || ptr != val.data() + val.size()) {
+      if constexpr (std::is_floating_point_v<T>) {
+        throw std::invalid_argument(std::string(val) + ": is not a float");
+      } else {
+        throw std::invalid_argument(std::string(val) + ": is not an integer");
+      }
+    }
+    return r;
+  }
+
+  // "name=value; name2=value2", pairs without '=' are skipped
+  void parse_cookies() const {
+    if (cookies_parsed_)
+      return;
+
+    cookies_parsed_ = true;
+    cookies_.clear();
+    session_cookie_ = -1;
+    auto str = get_header_value("cookie");
+    while (!str.empty()) {
+      size_t end = str.find(';');
+      auto pair = trim(str.substr(0, end));
+      str.remove_prefix(end == std::string_view::npos ? str.size() : end + 1);
+
+      size_t eq = pair.find('=');
+      if (eq == std::string_view::npos)
+        continue;
+
+      auto name = trim(pair.substr(0, eq));
+      if (name == CSESSIONID && session_cookie_ < 0)
+        session_cookie_ = (int)cookies_.size();
+      cookies_.emplace(name, trim(pair.substr(eq + 1)));
+    }
   }
 
   void check_gzip() {
@@ -835,6 +876,7 @@ private:
 
   size_t num_headers_ = 0;
   struct phr_header headers_[32];
+  header_index header_index_;
   const char *method_ = nullptr;
   size_t method_len_ = 0;
   const char *url_ = nullptr;
@@ -846,7 +888,9 @@ private:
   std::string raw_url_;
   std::string method_str_;
   std::string url_str_;
-  std::string cookie_str_;
+  mutable query_params cookies_;
+  mutable int session_cookie_ = -1;
+  mutable bool cookies_parsed_ = false;
   std::vector<std::pair<std::string, std::string>> copy_headers_;
 
   size_t cur_size_ = 0;
@@ -854,8 +898,12 @@ private:
 
   size_t last_len_ = 0; // for pipeline, last request buffer position
 
-  std::map<std::string_view, std::string_view> queries_;
-  std::map<std::string_view, std::string_view> form_url_map_;
+  // decoded copies of the query string and the form body, queries_ and
+  // form_url_map_ point into them
+  std::string query_str_;
+  std::string form_str_;
+  query_params queries_;
+  query_params form_url_map_;
   std::map<std::string, std::string> multipart_form_map_;
   bool has_gzip_ = false;
   std::string gzip_str_;
@@ -873,9 +921,9 @@ private:
   std::map<std::string, std::string> multipart_headers_;
   std::string last_multpart_key_;
   std::vector<upload_file> files_;
-  std::map<std::string, std::string> utf8_character_params_;
   std::map<std::string, std::string> utf8_character_pathinfo_params_;
   std::int64_t range_start_pos_ = 0;
+  std::int64_t range_end_pos_ = -1;
   bool is_range_resource_ = 0;
   std::int64_t static_resource_file_size_ = 0;
   std::unordered_map<std::string, std::any> aspect_data_;
@@ -8,10 +8,16 @@
 #include "itoa.hpp"
 #include "mime_types.hpp"
 #include "response_cv.hpp"
+#include "response_stream.hpp"
 #include "session_manager.hpp"
+#include "sse.hpp"
 #include "use_asio.hpp"
 #include "utils.hpp"
+#include <charconv>
 #include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -92,15 +98,19 @@ public:
     }
 
     char temp[20] = {};
-    itoa_fwd((int)content_.size(), temp);
+    if (file_body_)
+      std::to_chars(temp, temp + sizeof(temp), file_body_size_);
+    else
+      itoa_fwd((int)content_.size(), temp);
     rep_str_.append("Content-Length: ").append(temp).append("\r\n");
     if (res_type_ != req_content_type::none) {
       rep_str_.append(get_content_type(res_type_));
     }
     rep_str_.append("Server: cinatra\r\n");
     if (session_ != nullptr && session_->is_need_update()) {
-      auto cookie_str = session_->get_cookie().to_string();
-      rep_str_.append("Set-Cookie: ").append(cookie_str).append("\r\n");
+      rep_str_.append("Set-Cookie: ");
+      session_->get_cookie().append_to(rep_str_);
+      rep_str_.append("\r\n");
       session_->set_need_update(false);
     }
 
@@ -115,11 +125,6 @@ public:
   std::vector<boost::asio::const_buffer> to_buffers() {
     std::vector<boost::asio::const_buffer> buffers;
     add_header("Host", "cinatra");
-    if (session_ != nullptr && session_->is_need_update()) {
-      auto cookie_str = session_->get_cookie().to_string();
-      add_header("Set-Cookie", cookie_str.c_str());
-      session_->set_need_update(false);
-    }
     buffers.reserve(headers_.size() * 4 + 5);
     buffers.emplace_back(to_buffer(status_));
     for (auto const &h : headers_) {
@@ -129,6 +134,15 @@ public:
       buffers.emplace_back(boost::asio::buffer(crlf));
     }
 
+    if (session_ != nullptr && session_->is_need_update()) {
+      // kept until the write is done, its capacity reused by the next one
+      set_cookie_.assign("Set-Cookie: ");
+      session_->get_cookie().append_to(set_cookie_);
+      set_cookie_.append("\r\n");
+      buffers.emplace_back(boost::asio::buffer(set_cookie_));
+      session_->set_need_update(false);
+    }
+
     buffers.push_back(boost::asio::buffer(crlf));
 
     if (body_type_ == content_type::string) {
@@ -148,6 +162,44 @@ public:
     return buffers;
   }
 
+  // starts a chunked response whose body is written through the returned
+  // stream, with the headers added so far; see response_stream. nullptr where
+  // the response can't be streamed, on an HTTP/2 stream
+  std::shared_ptr<response_stream>
+  stream(status_type status = status_type::ok,
+         size_t window = response_stream::default_window) {
+    if (!stream_factory_)
+      return nullptr;
+
+    // the connection must not write a response of its own
+    delay_ = true;
+    return stream_factory_(chunked_head(status), window);
+  }
+
+  void set_stream_factory(
+      std::function<std::shared_ptr<response_stream>(std::string, size_t)>
+          factory) {
+    stream_factory_ = std::move(factory);
+  }
+
+  // turns the response into a text/event-stream that follows topic, see
+  // sse_topic; false where the response can't be streamed, on an HTTP/2
+  // stream
+  bool sse(sse_topic &topic) {
+    if (!sse_starter_)
+      return false;
+
+    add_header("Content-Type", "text/event-stream");
+    add_header("Cache-Control", "no-cache");
+    delay_ = true;
+    sse_starter_(topic, chunked_head(status_type::ok));
+    return true;
+  }
+
+  void set_sse_starter(std::function<void(sse_topic &, std::string)> starter) {
+    sse_starter_ = std::move(starter);
+  }
+
   void add_header(std::string &&key, std::string &&value) {
     headers_.emplace_back(std::move(key), std::move(value));
   }
@@ -192,6 +244,23 @@ public:
     build_response_str();
   }
 
+  // a body of size bytes read from file, from where it stands, as it is sent
+  // instead of being built in memory; HTTP/2 streams serve static files so
+  void set_status_and_file(status_type status,
+                           std::shared_ptr<std::ifstream> file, uint64_t size) {
+    status_ = status;
+    file_body_ = std::move(file);
+    file_body_size_ = size;
+    content_.clear();
+    build_response_str();
+  }
+
+  std::shared_ptr<std::ifstream> take_file_body() {
+    return std::move(file_body_);
+  }
+
+  uint64_t file_body_size() const { return file_body_size_; }
+
   std::string_view get_content_type(req_content_type type) {
     switch (type) {
     case cinatra::req_content_type::html:
@@ -219,6 +288,8 @@ public:
     delay_ = false;
     headers_.clear();
     content_.clear();
+    file_body_ = nullptr;
+    file_body_size_ = 0;
     session_ = nullptr;
 
     if (cache_data.empty())
@@ -333,6 +404,27 @@ public:
   }
 
 private:
+  // the status line and headers of a chunked response
+  std::string chunked_head(status_type status) {
+    status_ = status;
+    std::string head(to_rep_string(status));
+    for (auto &header : headers_) {
+      head.append(header.first)
+          .append(": ")
+          .append(header.second)
+          .append("\r\n");
+    }
+    headers_.clear();
+    if (session_ != nullptr && session_->is_need_update()) {
+      head.append("Set-Cookie: ");
+      session_->get_cookie().append_to(head);
+      head.append("\r\n");
+      session_->set_need_update(false);
+    }
+    head.append("Transfer-Encoding: chunked\r\n\r\n");
+    return head;
+  }
+
   std::string_view get_header_value(std::string_view key) const {
     phr_header *headers = req_headers_.first;
     size_t num_headers = req_headers_.second;
@@ -349,6 +441,8 @@ private:
   std::vector<std::pair<std::string, std::string>> headers_;
   std::vector<std::string> cache_data;
   std::string content_;
+  std::shared_ptr<std::ifstream> file_body_;
+  uint64_t file_body_size_ = 0;
   content_type body_type_ = content_type::unknown;
   status_type status_ = status_type::init;
   bool proc_continue_ = true;
@@ -360,7 +454,11 @@ private:
   std::string_view domain_;
   std::string_view path_;
   std::shared_ptr<cinatra::session> session_ = nullptr;
+  std::function<std::shared_ptr<response_stream>(std::string, size_t)>
+      stream_factory_;
+  std::function<void(sse_topic &, std::string)> sse_starter_;
   std::string rep_str_;
+  std::string set_cookie_;
   std::chrono::system_clock::time_point last_time_ =
       std::chrono::system_clock::now();
   std::string last_date_str_;
@@ -0,0 +1,184 @@
+#pragma once
+#include "response_cv.hpp"
+#include "use_asio.hpp"
+#include "utils.hpp"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cinatra {
+// A response body written a piece at a time with chunked transfer encoding,
+// for handlers that generate their output (exports, event streams) instead
+// of building it in memory. response::stream() starts one:
+//   auto out = res.stream();
+//   out->async_write(rows(0), [out](auto ec) { ... write the next rows ... });
+//   ...
+//   out->async_end();
+// Backpressure: async_write() completes once the bytes queued behind the
+// socket are at most the window, so a producer that writes its next piece
+// from the completion holds no more than the window and one piece, and runs
+// at the pace of the client. The calls may come from any thread, completions
+// run on the connection's thread. A failed write completes every pending
+// call with its error and closes the connection; async_end() hands the
+// connection back to keep-alive.
+class response_stream : public std::enable_shared_from_this<response_stream> {
+public:
+  using callback = std::function<void(const boost::system::error_code &)>;
+  static constexpr size_t default_window = 256 * 1024;
+
+  virtual ~response_stream() {}
+
+  void async_write(std::string data, callback cb = nullptr) {
+    boost::asio::post(io_service_, [this, self = shared_from_this(),
+                                    data = std::move(data),
+                                    cb = std::move(cb)]() mutable {
+      if (ended_ || error_) {
+        complete(cb, closed_error());
+        return;
+      }
+      if (data.empty()) {
+        complete(cb, {});
+        return;
+      }
+
+      in_flight_ += data.size();
+      enqueue(std::move(data));
+      if (in_flight_ <= window_ && waiting_.empty())
+        complete(cb, {});
+      else if (cb)
+        waiting_.push_back(std::move(cb));
+    });
+  }
+
+  // writes the last chunk, cb runs once it is written
+  void async_end(callback cb = nullptr) {
+    boost::asio::post(io_service_, [this, self = shared_from_this(),
+                                    cb = std::move(cb)]() mutable {
+      if (ended_ || error_) {
+        complete(cb, closed_error());
+        return;
+      }
+
+      ended_ = true;
+      end_cb_ = std::move(cb);
+      enqueue({});
+    });
+  }
+
+  // the bytes written but not yet on the socket, on the connection's thread
+  size_t in_flight() const { return in_flight_; }
+
+  size_t window() const { return window_; }
+
+protected:
+  // head is the status line and headers, sent with the first chunk
+  response_stream(boost::asio::io_service &io_service, std::string head,
+                  size_t window)
+      : io_service_(io_service), head_(std::move(head)), window_(window) {}
+
+  // writes buffers to the client, then calls on_written()
+  virtual void write(const std::vector<boost::asio::const_buffer> &buffers) = 0;
+
+  // the response is complete, or failed: the connection goes on with its
+  // next request or closes
+  virtual void finish(bool ok) = 0;
+
+  void on_written(const boost::system::error_code &ec) {
+    writing_.clear();
+    in_flight_ -= writing_size_;
+    writing_size_ = 0;
+    if (ec) {
+      fail(ec);
+      return;
+    }
+
+    if (in_flight_ <= window_) {
+      // a completion may write again, it only queues
+      auto waiting = std::move(waiting_);
+      waiting_.clear();
+      for (auto &cb : waiting)
+        complete(cb, {});
+    }
+
+    if (!queued_.empty()) {
+      write_queued();
+    } else if (ended_) {
+      complete(end_cb_, {});
+      finish(true);
+    }
+  }
+
+private:
+  struct chunk {
+    std::string size_line; // the head before the first chunk, then hex size
+    std::string data;
+  };
+
+  void enqueue(std::string data) {
+    chunk c;
+    if (!head_.empty())
+      c.size_line = std::move(head_);
+    c.size_line.append(to_hex_string(data.size())).append("\r\n");
+    c.data = std::move(data);
+    queued_.push_back(std::move(c));
+    if (writing_.empty())
+      write_queued();
+  }
+
+  // everything queued goes out in one gathered write
+  void write_queued() {
+    std::swap(writing_, queued_);
+    buffers_.clear();
+    for (auto &c : writing_) {
+      buffers_.push_back(boost::asio::buffer(c.size_line));
+      if (!c.data.empty()) {
+        buffers_.push_back(boost::asio::buffer(c.data));
+        writing_size_ += c.data.size();
+      }
+      buffers_.push_back(boost::asio::buffer(crlf));
+    }
+    write(buffers_);
+  }
+
+  void fail(const boost::system::error_code &ec) {
+    error_ = ec;
+    queued_.clear();
+    in_flight_ = 0;
+    auto waiting = std::move(waiting_);
+    waiting_.clear();
+    for (auto &cb : waiting)
+      complete(cb, ec);
+    complete(end_cb_, ec);
+    finish(false);
+  }
+
+  boost::system::error_code closed_error() const {
+    if (error_)
+      return error_;
+    return boost::asio::error::shut_down;
+  }
+
+  static void complete(callback &cb, const boost::system::error_code &ec) {
+    if (cb) {
+      auto f = std::move(cb);
+      cb = nullptr;
+      f(ec);
+    }
+  }
+
+  boost::asio::io_service &io_service_;
+  std::string head_;
+  const size_t window_;
+  size_t in_flight_ = 0;
+  size_t writing_size_ = 0;
+  std::deque<chunk> queued_;
+  std::deque<chunk> writing_;
+  std::vector<boost::asio::const_buffer> buffers_;
+  std::deque<callback> waiting_;
+  callback end_cb_;
+  bool ended_ = false;
+  boost::system::error_code error_;
+};
+} // namespace cinatra
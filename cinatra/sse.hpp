@@ -0,0 +1,144 @@
+#pragma once
+#include "utils.hpp"
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cinatra {
+// an event formatted once, as the HTTP chunk every subscriber writes
+struct sse_event {
+  uint64_t id;
+  std::string chunk;
+};
+
+// the text/event-stream form of an event, framed as one chunk
+inline std::string format_sse_event(uint64_t id, std::string_view event,
+                                    std::string_view data) {
+  std::string body;
+  body.reserve(data.size() + event.size() + 40);
+  char buf[20];
+  auto r = std::to_chars(buf, buf + sizeof(buf), id);
+  body.append("id: ").append(buf, r.ptr).append("\n");
+  if (!event.empty())
+    body.append("event: ").append(event).append("\n");
+  // every line of data is a data field of its own
+  for (size_t pos = 0;;) {
+    size_t end = data.find_first_of("\r\n", pos);
+    body.append("data: ").append(data.substr(pos, end - pos)).append("\n");
+    if (end == std::string_view::npos)
+      break;
+    pos = end + (data.substr(end, 2) == "\r\n" ? 2 : 1);
+  }
+  body.append("\n");
+
+  std::string chunk = to_hex_string(body.size());
+  chunk.reserve(chunk.size() + body.size() + 4);
+  chunk.append("\r\n").append(body).append("\r\n");
+  return chunk;
+}
+
+class sse_subscriber : public std::enable_shared_from_this<sse_subscriber> {
+public:
+  virtual ~sse_subscriber() {}
+
+  // queues an event for the client, called from any thread
+  virtual void deliver(std::shared_ptr<const std::string> chunk) = 0;
+
+  // the kept events a resuming client missed, before any live one; a
+  // subscriber that writes them as it goes need not hold them as queued
+  virtual void replay(std::vector<std::shared_ptr<const std::string>> chunks) {
+    for (auto &chunk : chunks)
+      deliver(std::move(chunk));
+  }
+};
+
+// A stream of events, e.g. the updates of one dashboard, that any number of
+// clients follow with response::sse(). publish() formats an event once and
+// hands the same buffer to every subscriber. The last history events are
+// kept so that a client that reconnects with Last-Event-ID gets what it
+// missed, written as the connection drains. A subscriber that falls more than
+// max_queued_bytes behind on live events is disconnected and left to
+// reconnect and resume, an idle one gets a comment every keep_alive to keep
+// proxies from dropping it. Thread safe.
+class sse_topic {
+public:
+  explicit sse_topic(size_t history = 1024) : history_(history) {}
+
+  // returns the id of the event
+  uint64_t publish(std::string_view data, std::string_view event = {}) {
+    std::lock_guard lock(mtx_);
+    uint64_t id = ++last_id_;
+    auto ev = std::make_shared<const sse_event>(
+        sse_event{id, format_sse_event(id, event, data)});
+    ring_.push_back(ev);
+    if (ring_.size() > history_)
+      ring_.pop_front();
+
+    std::shared_ptr<const std::string> chunk(ev, &ev->chunk);
+    for (size_t i = 0; i < subscribers_.size();) {
+      if (auto s = subscribers_[i].lock()) {
+        s->deliver(chunk);
+        i++;
+      } else {
+        // gone, its connection closed
+        subscribers_[i] = std::move(subscribers_.back());
+        subscribers_.pop_back();
+      }
+    }
+    return id;
+  }
+
+  // last_event_id is the Last-Event-ID of a reconnecting client, the events
+  // after it that are still kept are sent first
+  void subscribe(const std::shared_ptr<sse_subscriber> &subscriber,
+                 std::optional<uint64_t> last_event_id = std::nullopt) {
+    std::lock_guard lock(mtx_);
+    if (last_event_id) {
+      std::vector<std::shared_ptr<const std::string>> missed;
+      for (auto &ev : ring_) {
+        if (ev->id > *last_event_id)
+          missed.emplace_back(ev, &ev->chunk);
+      }
+      if (!missed.empty())
+        subscriber->replay(std::move(missed));
+    }
+    subscribers_.push_back(subscriber);
+  }
+
+  size_t subscriber_count() {
+    std::lock_guard lock(mtx_);
+    return subscribers_.size();
+  }
+
+  uint64_t last_event_id() {
+    std::lock_guard lock(mtx_);
+    return last_id_;
+  }
+
+  void set_max_queued_bytes(size_t bytes) { max_queued_bytes_ = bytes; }
+
+  size_t max_queued_bytes() const { return max_queued_bytes_; }
+
+  void set_keep_alive(std::chrono::seconds interval) {
+    keep_alive_ = interval;
+  }
+
+  std::chrono::seconds keep_alive() const { return keep_alive_; }
+
+private:
+  std::mutex mtx_;
+  const size_t history_;
+  std::deque<std::shared_ptr<const sse_event>> ring_;
+  std::vector<std::weak_ptr<sse_subscriber>> subscribers_;
+  uint64_t last_id_ = 0;
+  size_t max_queued_bytes_ = 1024 * 1024;
+  std::chrono::seconds keep_alive_{15};
+};
+} // namespace cinatra
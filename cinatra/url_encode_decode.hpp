@@ -5,49 +5,256 @@
 #ifndef CPPWEBSERVER_URL_ENCODE_DECODE_HPP
 #define CPPWEBSERVER_URL_ENCODE_DECODE_HPP
 #include <codecvt>
+#include <cstdint>
+#include <cstring>
 #include <locale>
 #include <string>
 #include <string_view>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define CINATRA_URL_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 namespace code_utils {
-inline static std::string url_encode(const std::string &value) noexcept {
-  static auto hex_chars = "0123456789ABCDEF";
+// a set of bytes, one bit each
+struct byte_set {
+  uint64_t bits[4] = {};
 
-  std::string result;
-  result.reserve(value.size()); // Minimum size of result
-
-  for (auto &chr : value) {
-    if (!((chr >= '0' && chr <= '9') || (chr >= 'A' && chr <= 'Z') ||
-          (chr >= 'a' && chr <= 'z') || chr == '-' || chr == '.' ||
-          chr == '_' || chr == '~'))
-      result += std::string("%") +
-                hex_chars[static_cast<unsigned char>(chr) >> 4] +
-                hex_chars[static_cast<unsigned char>(chr) & 15];
-    else
-      result += chr;
+  constexpr byte_set(std::string_view chars) {
+    for (unsigned char c : chars)
+      bits[c >> 6] |= uint64_t(1) << (c & 63);
   }
 
-  return result;
+  constexpr bool contains(unsigned char c) const {
+    return (bits[c >> 6] >> (c & 63)) & 1;
+  }
+
+  constexpr bool contains(const byte_set &other) const {
+    for (int i = 0; i < 4; i++) {
+      if ((other.bits[i] & bits[i]) != other.bits[i])
+        return false;
+    }
+    return true;
+  }
+
+  constexpr byte_set operator|(std::string_view chars) const {
+    byte_set set = *this;
+    for (unsigned char c : chars)
+      set.bits[c >> 6] |= uint64_t(1) << (c & 63);
+    return set;
+  }
+};
+
+// letters, digits, '-', '.' and '_', kept by every encoder here and the set
+// the vector scan recognizes
+inline constexpr byte_set url_word_chars{
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._"};
+// the unreserved characters of RFC 3986, what url_encode() keeps
+inline constexpr byte_set url_unreserved = url_word_chars | "~";
+
+namespace detail {
+inline static int first_bit(unsigned mask) noexcept {
+#ifdef _MSC_VER
+  unsigned long n;
+  _BitScanForward(&n, mask);
+  return (int)n;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+} // namespace detail
+
+// the length of the leading run of data with no '%' (and no '+' if
+// plus_as_space), the part decoding copies as is
+inline static size_t url_plain_run(const char *data, size_t size,
+                                   bool plus_as_space = true) noexcept {
+  size_t i = 0;
+#ifdef CINATRA_URL_SSE2
+  const __m128i percent = _mm_set1_epi8('%');
+  const __m128i plus = _mm_set1_epi8(plus_as_space ? '+' : '%');
+  for (; i + 16 <= size; i += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)(data + i));
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(b, percent), _mm_cmpeq_epi8(b, plus)));
+    if (mask != 0)
+      return i + detail::first_bit(mask);
+  }
+#endif
+  for (; i < size; i++) {
+    if (data[i] == '%' || (plus_as_space && data[i] == '+'))
+      break;
+  }
+  return i;
+}
+
+// the length of the leading run of data that keep leaves unencoded
+inline static size_t url_safe_run(const char *data, size_t size,
+                                  const byte_set &keep) noexcept {
+  size_t i = 0;
+#ifdef CINATRA_URL_SSE2
+  if (keep.contains(url_word_chars)) {
+    // (c | 0x20) is in 'a'..'z' for letters of either case and nothing else
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i a = _mm_set1_epi8('a');
+    const __m128i az = _mm_set1_epi8('z' - 'a');
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i dash = _mm_set1_epi8('-');
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i underscore = _mm_set1_epi8('_');
+    for (; i + 16 <= size; i += 16) {
+      __m128i b = _mm_loadu_si128((const __m128i *)(data + i));
+      __m128i letter = _mm_sub_epi8(_mm_or_si128(b, case_bit), a);
+      __m128i digit = _mm_sub_epi8(b, zero);
+      __m128i ok = _mm_or_si128(
+          _mm_cmpeq_epi8(_mm_min_epu8(letter, az), letter),
+          _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit));
+      ok = _mm_or_si128(ok, _mm_cmpeq_epi8(b, dash));
+      ok = _mm_or_si128(ok, _mm_cmpeq_epi8(b, dot));
+      ok = _mm_or_si128(ok, _mm_cmpeq_epi8(b, underscore));
+      // the rest, e.g. '/' for quote(), is looked up in keep
+      unsigned mask = (unsigned)_mm_movemask_epi8(ok) ^ 0xffff;
+      for (; mask != 0; mask &= mask - 1) {
+        size_t j = i + detail::first_bit(mask);
+        if (!keep.contains((unsigned char)data[j]))
+          return j;
+      }
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    if (!keep.contains((unsigned char)data[i]))
+      break;
+  }
+  return i;
+}
+
+inline static int hex_digit(char c) noexcept {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// decodes the escape at data[0] into out, returns the bytes consumed. a '%'
+// without two hex digits is kept as is
+inline static size_t url_decode_escape(const char *data, size_t size,
+                                       char &out) noexcept {
+  if (data[0] == '%') {
+    int hi = size > 2 ? hex_digit(data[1]) : -1;
+    int lo = size > 2 ? hex_digit(data[2]) : -1;
+    if (hi >= 0 && lo >= 0) {
+      out = (char)(hi << 4 | lo);
+      return 3;
+    }
+    out = '%';
+    return 1;
+  }
+
+  out = data[0] == '+' ? ' ' : data[0];
+  return 1;
+}
+
+// the decoded text is never longer, so it is written over the encoded one;
+// returns the decoded size
+inline static size_t url_decode_in_place(char *data, size_t size,
+                                         bool plus_as_space = true) noexcept {
+  size_t in = url_plain_run(data, size, plus_as_space);
+  size_t out = in;
+  while (in < size) {
+    in += url_decode_escape(data + in, size - in, data[out]);
+    out++;
+    size_t run = url_plain_run(data + in, size - in, plus_as_space);
+    memmove(data + out, data + in, run);
+    in += run;
+    out += run;
+  }
+
+  return out;
 }
 
-inline static std::string url_decode(const std::string &value) noexcept {
+// appends the decoded value to out
+inline static void url_decode(std::string_view value, std::string &out,
+                              bool plus_as_space = true) {
+  const char *data = value.data();
+  size_t size = value.size();
+  out.reserve(out.size() + size);
+  size_t in = 0;
+  while (in < size) {
+    size_t run = url_plain_run(data + in, size - in, plus_as_space);
+    out.append(data + in, run);
+    in += run;
+    if (in == size)
+      break;
+
+    char chr;
+    in += url_decode_escape(data + in, size - in, chr);
+    out.push_back(chr);
+  }
+}
+
+inline static std::string url_decode(const std::string &value) {
   std::string result;
-  result.reserve(value.size() / 3 +
-                 (value.size() % 3)); // Minimum size of result
-
-  for (std::size_t i = 0; i < value.size(); ++i) {
-    auto &chr = value[i];
-    if (chr == '%' && i + 2 < value.size()) {
-      auto hex = value.substr(i + 1, 2);
-      auto decoded_chr =
-          static_cast<char>(std::strtol(hex.c_str(), nullptr, 16));
-      result += decoded_chr;
-      i += 2;
-    } else if (chr == '+')
-      result += ' ';
-    else
-      result += chr;
+  url_decode(value, result);
+  return result;
+}
+
+// appends value to out with every byte outside keep written as %XX
+inline static void url_encode(std::string_view value, std::string &out,
+                              const byte_set &keep = url_unreserved) {
+  static constexpr char hex_chars[] = "0123456789ABCDEF";
+  const char *data = value.data();
+  size_t size = value.size();
+  out.reserve(out.size() + size);
+  size_t in = 0;
+  while (in < size) {
+    size_t run = url_safe_run(data + in, size - in, keep);
+    out.append(data + in, run);
+    in += run;
+    if (in == size)
+      break;
+
+    unsigned char chr = (unsigned char)data[in++];
+    char escape[3] = {'%', hex_chars[chr >> 4], hex_chars[chr & 15]};
+    out.append(escape, 3);
+  }
+}
+
+// encodes value in place, growing it by two bytes per escape
+inline static void url_encode_in_place(std::string &value,
+                                       const byte_set &keep = url_unreserved) {
+  static constexpr char hex_chars[] = "0123456789ABCDEF";
+  size_t size = value.size();
+  size_t escapes = 0;
+  for (size_t i = url_safe_run(value.data(), size, keep); i < size;) {
+    escapes++;
+    i++;
+    i += url_safe_run(value.data() + i, size - i, keep);
   }
+  if (escapes == 0)
+    return;
 
+  value.resize(size + 2 * escapes);
+  char *data = value.data();
+  for (size_t in = size, out = value.size(); in != out;) {
+    unsigned char chr = (unsigned char)data[--in];
+    if (keep.contains(chr)) {
+      data[--out] = (char)chr;
+    } else {
+      data[--out] = hex_chars[chr & 15];
+      data[--out] = hex_chars[chr >> 4];
+      data[--out] = '%';
+    }
+  }
+}
+
+inline static std::string url_encode(const std::string &value) {
+  std::string result;
+  url_encode(value, result);
   return result;
 }
 
@@ -62,12 +269,13 @@ inline static std::wstring u8string_to_wstring(const std::string &str) {
 }
 
 inline static std::string get_string_by_urldecode(std::string_view content) {
-  return url_decode(std::string(content.data(), content.size()));
+  std::string result;
+  url_decode(content, result);
+  return result;
 }
 
 inline static bool is_url_encode(std::string_view str) {
-  return str.find("%") != std::string_view::npos ||
-         str.find("+") != std::string_view::npos;
+  return url_plain_run(str.data(), str.size()) != str.size();
 }
 } // namespace code_utils
 #endif // CPPWEBSERVER_URL_ENCODE_DECODE_HPP
\ No newline at end of file
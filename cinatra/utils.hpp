@@ -7,6 +7,7 @@
 
 #pragma once
 #include "define.h"
+#include "url_encode_decode.hpp"
 #include <algorithm>
 #include <array>
 #if defined(ASIO_STANDALONE)
@@ -369,82 +370,35 @@ inline void print(const boost::system::error_code &ec) {
   print(ec.value(), ec.message());
 }
 
-// var bools = [];
-// var valid_chr =
-// 'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_.-'; for(var
-// i = 0; i <= 127; ++ i) { 	var contain =
-// valid_chr.indexOf(String.fromCharCode(i)) == -1;
-// 	bools.push(contain?false:true);
-// }
-// console.log(JSON.stringify(bools))
-
-inline const constexpr bool valid_chr[128] = {
-    false, false, false, false, false, false, false, false, false, false, false,
-    false, false, false, false, false, false, false, false, false, false, false,
-    false, false, false, false, false, false, false, false, false, false, false,
-    false, false, false, false, false, false, false, false, false, false, false,
-    false, true,  true,  false, true,  true,  true,  true,  true,  true,  true,
-    true,  true,  true,  false, false, false, false, false, false, false, true,
-    true,  true,  true,  true,  true,  true,  true,  true,  true,  true,  true,
-    true,  true,  true,  true,  true,  true,  true,  true,  true,  true,  true,
-    true,  true,  true,  false, false, false, false, true,  false, true,  true,
-    true,  true,  true,  true,  true,  true,  true,  true,  true,  true,  true,
-    true,  true,  true,  true,  true,  true,  true,  true,  true,  true,  true,
-    true,  true,  false, false, false, false, false};
-
-inline std::ostringstream &quote_impl(std::ostringstream &os,
-                                      std::string_view str,
-                                      std::string_view safe) {
-  os << std::setiosflags(std::ios::right) << std::setfill('0');
-  auto begin = reinterpret_cast<const std::byte *>(str.data());
-  auto end = begin + sizeof(char) * str.size();
-  std::for_each(begin, end, [&os, &safe](auto &chr) {
-    char chrval = (char)chr;
-    unsigned int intval = (unsigned int)chr;
-    if ((intval > 127 || !valid_chr[intval]) &&
-        safe.find(chrval) == std::string_view::npos)
-      os << '%' << std::setw(2) << std::hex << std::uppercase << intval;
-    else
-      os << chrval;
-  });
-  return os;
-}
+// what quote() keeps besides its safe characters, like python's
+// urllib.parse.quote before 3.7
+inline constexpr code_utils::byte_set quote_chars = code_utils::url_word_chars;
 
 inline const std::string quote(std::string_view str) {
-  std::ostringstream os;
-  return quote_impl(os, str, "/").str();
+  std::string out;
+  code_utils::url_encode(str, out, quote_chars | "/");
+  return out;
 }
 
 inline const std::string quote_plus(std::string_view str) {
   if (str.find(' ') == std::string_view::npos)
     return quote(str);
 
-  std::ostringstream os;
-  auto strval = quote_impl(os, str, " ").str();
-  std::replace(strval.begin(), strval.end(), ' ', '+');
-  return strval;
+  std::string out;
+  code_utils::url_encode(str, out, quote_chars | " ");
+  std::replace(out.begin(), out.end(), ' ', '+');
+  return out;
 }
 
+// decodes %XX only, '+' stays as is
 inline std::string form_urldecode(const std::string &src) {
   std::string ret;
-  char ch;
-  int i, ii;
-  for (i = 0; i < src.length(); i++) {
-    if (int(src[i]) == 37) {
-      sscanf(src.substr(i + 1, 2).c_str(), "%x", &ii);
-      ch = static_cast<char>(ii);
-      ret += ch;
-      i = i + 2;
-    } else {
-      ret += src[i];
-    }
-  }
+  code_utils::url_decode(src, ret, false);
   return ret;
 }
 
 inline bool is_form_url_encode(std::string_view str) {
-  return str.find("%") != std::string_view::npos ||
-         str.find("+") != std::string_view::npos;
+  return code_utils::is_url_encode(str);
 }
 
 inline std::string_view get_extension(std::string_view name) {
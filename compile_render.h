@@ -0,0 +1,295 @@
+//
+// Templates that ship with the binary, parsed at compile time.
+//
+
+#ifndef CLION_COMPILE_RENDER_H
+#define CLION_COMPILE_RENDER_H
+
+#include <charconv>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "cinatra/render.h"
+#include "compile_parse.h"
+
+namespace render {
+namespace static_detail {
+// a literal chunk is text[from, from + size), a slot is names[slot]
+struct chunk {
+  size_t from = 0;
+  size_t size = 0;
+  int slot = -1;
+};
+
+// first pass: the sizes of the parsed_template below, counted with
+// compile-time storage only
+template<size_t N>
+struct template_counter {
+  size_t text_size = 0;
+  size_t chunk_count = 0;
+  bool in_literal = false;
+  static_vector<std::string_view, N> names;
+
+  constexpr void literal(std::string_view s) {
+    if (s.empty()) {
+      return;
+    }
+    if (!in_literal) {
+      ++chunk_count;
+      in_literal = true;
+    }
+    text_size += s.size();
+  }
+
+  constexpr void slot(std::string_view name) {
+    size_t i = 0;
+    while (i < names.size() && names[i] != name) {
+      ++i;
+    }
+    if (i == names.size()) {
+      names.emplace_back(name);
+    }
+    ++chunk_count;
+    in_literal = false;
+  }
+};
+
+// second pass: exactly as many bytes, chunks and names as the template has
+template<size_t TextSize, size_t ChunkCount, size_t NameCount>
+struct parsed_template {
+  std::array<char, TextSize> text{};
+  size_t text_size = 0;
+  static_vector<chunk, ChunkCount> chunks;
+  static_vector<std::string_view, NameCount> names;
+
+  constexpr void literal(std::string_view s) {
+    if (s.empty()) {
+      return;
+    }
+    if (chunks.size() == 0 || chunks[chunks.size() - 1].slot >= 0) {
+      chunks.emplace_back(chunk{text_size, 0, -1});
+    }
+    for (char c : s) {
+      text[text_size++] = c;
+    }
+    chunks[chunks.size() - 1].size += s.size();
+  }
+
+  constexpr void slot(std::string_view name) {
+    size_t i = 0;
+    while (i < names.size() && names[i] != name) {
+      ++i;
+    }
+    if (i == names.size()) {
+      names.emplace_back(name);
+    }
+    chunks.emplace_back(chunk{0, 0, (int)i});
+  }
+};
+
+constexpr auto is_variable_char(char c) -> bool {
+  return c > 32 && c != '{' && c != '}';
+}
+
+// the subset of the render syntax that needs no data structure: ${var},
+// ${a.b} (json only), $$, ${{, $}}, $# comments
+template<typename Sink>
+constexpr void parse(std::string_view s, Sink& t) {
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t from = i;
+    while (i < s.size() && s[i] != '$') {
+      ++i;
+    }
+    t.literal(s.substr(from, i - from));
+    if (i == s.size()) {
+      break;
+    }
+
+    ++i;
+    if (i == s.size()) {
+      throw std::runtime_error("Unexpected end of template after $");
+    }
+    if (s[i] == '$') {
+      t.literal("$");
+      ++i;
+    } else if (s[i] == '#') {
+      while (i < s.size() && s[i] != '\n') {
+        ++i;
+      }
+    } else if (s.substr(i).starts_with("{{")) {
+      t.literal("{{");
+      i += 2;
+    } else if (s.substr(i).starts_with("}}")) {
+      t.literal("}}");
+      i += 2;
+    } else if (s[i] == '{') {
+      ++i;
+      while (i < s.size() && SourceStream::is_space_char(s[i])) {
+        ++i;
+      }
+      size_t name = i;
+      while (i < s.size() && is_variable_char(s[i])) {
+        ++i;
+      }
+      if (name == i) {
+        throw std::runtime_error("Expected variable after ${");
+      }
+      t.slot(s.substr(name, i - name));
+      while (i < s.size() && SourceStream::is_space_char(s[i])) {
+        ++i;
+      }
+      if (i == s.size() || s[i] != '}') {
+        throw std::runtime_error("Expected }");
+      }
+      ++i;
+    } else {
+      throw std::runtime_error(
+          "Static templates only support ${var}, use compiled_template for "
+          "$for, $if, $include and $inline");
+    }
+  }
+}
+
+template<const_string Tpl>
+constexpr auto parse() {
+  constexpr auto counts = [] {
+    template_counter<Tpl.size()> counter{};
+    parse(Tpl.str(), counter);
+    return std::array{counter.text_size, counter.chunk_count,
+                      counter.names.size()};
+  }();
+  parsed_template<counts[0], counts[1], counts[2]> t{};
+  parse(Tpl.str(), t);
+  return t;
+}
+
+// floats are written in their shortest round-trip form, not with
+// render_string()'s 64 digits
+inline void append_float(double value, std::string& out) {
+  char buf[32];
+  auto r = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, r.ptr);
+}
+
+template<typename T>
+inline void append_arg(const T& value, std::string& out) {
+  if constexpr (std::is_floating_point_v<T>) {
+    append_float(value, out);
+  } else if constexpr (std::is_arithmetic_v<T>) {
+    internal::append_value(value, out);
+  } else if constexpr (std::is_same_v<T, json>) {
+    if (value.is_number_float()) {
+      append_float(value.template get<double>(), out);
+    } else if (!internal::append_value(value, out)) {
+      throw std::runtime_error("This value does not have operator<<().");
+    }
+  } else {
+    static_assert(std::is_convertible_v<const T&, std::string_view>,
+                  "a slot takes strings, numbers, bools or json scalars");
+    out.append(std::string_view(value));
+  }
+}
+
+inline auto lookup(const json& data, std::string_view name) -> const json& {
+  const json* value = &data;
+  while (true) {
+    auto dot = name.find('.');
+    auto key = name.substr(0, dot);
+    auto it = value->is_object() ? value->find(key) : value->end();
+    if (it == value->end()) {
+      throw std::runtime_error("Variable \"" + std::string(key) +
+                               "\" is not found");
+    }
+    value = &*it;
+    if (dot == std::string_view::npos) {
+      return *value;
+    }
+    name.remove_prefix(dot + 1);
+  }
+}
+}  // namespace static_detail
+
+// A template whose text is known at compile time, parsed into literal chunks
+// and slots by the compiler. Rendering appends the literals and formats the
+// slots, no parsing or lookups are left for runtime:
+//   constexpr auto page = $tpl("<h1>${title}</h1><p>${count} items</p>");
+//   page.render(out, title, count);  // one argument per name, first use order
+//   page.render_json(out, json);     // or by name from json
+template<const_string Tpl>
+struct static_template {
+  static constexpr auto parsed = static_detail::parse<Tpl>();
+
+  static constexpr auto names() -> std::span<const std::string_view> {
+    return {parsed.names.data(), parsed.names.size()};
+  }
+
+  // the size of the output without the slots
+  static constexpr auto literal_size() -> size_t {
+    return parsed.text_size;
+  }
+
+  template<typename... Args>
+  void render(std::string& out, const Args&... args) const {
+    static_assert(sizeof...(Args) == parsed.names.size(),
+                  "one argument per template variable");
+    out.reserve(out.size() + literal_size() + 16 * sizeof...(Args));
+    emit(out, std::forward_as_tuple(args...),
+         std::make_index_sequence<parsed.chunks.size()>{});
+  }
+
+  template<typename... Args>
+  auto render(const Args&... args) const -> std::string {
+    std::string out;
+    render(out, args...);
+    return out;
+  }
+
+  // throws std::runtime_error if a variable is missing or not a scalar
+  void render_json(std::string& out, const json& data) const {
+    // every name is looked up once, even if used several times
+    std::array<const json*, parsed.names.size()> values{};
+    for (size_t i = 0; i < values.size(); ++i) {
+      values[i] = &static_detail::lookup(data, parsed.names[i]);
+    }
+    out.reserve(out.size() + literal_size() + 16 * values.size());
+    [&]<size_t... I>(std::index_sequence<I...>) {
+      (emit_chunk<I>(out, values), ...);
+    }(std::make_index_sequence<parsed.chunks.size()>{});
+  }
+
+ private:
+  template<size_t I, typename Values>
+  static void emit_chunk(std::string& out, const Values& values) {
+    constexpr auto c = parsed.chunks[I];
+    if constexpr (c.slot < 0) {
+      out.append(parsed.text.data() + c.from, c.size);
+    } else {
+      static_detail::append_arg(*values[c.slot], out);
+    }
+  }
+
+  template<typename Tuple, size_t... I>
+  static void emit(std::string& out, const Tuple& args,
+                   std::index_sequence<I...>) {
+    (
+        [&] {
+          constexpr auto c = parsed.chunks[I];
+          if constexpr (c.slot < 0) {
+            out.append(parsed.text.data() + c.from, c.size);
+          } else {
+            static_detail::append_arg(std::get<c.slot>(args), out);
+          }
+        }(),
+        ...);
+  }
+};
+}  // namespace render
+
+#define $tpl(text) render::static_template<const_string{text}>{}
+
+#endif  // CLION_COMPILE_RENDER_H
@@ -1,74 +1,1757 @@
 #include "easylog.h"
 
+#include <spdlog/fmt/bundled/args.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/sinks/uring_file_sink.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
-bool always_flush_ = false;
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#endif
 
-template <typename... Args>
-inline void log(spdlog::level::level_enum level,
-                source_location location,
-                fmt::format_string<Args...> fmt,
-                Args&&... args) {
-  std::filesystem::path p{location.file_name()};
+namespace {
+// What the log path reads, replaced as a whole by init_log() and
+// enable_always_flush(), never modified in place.
+struct log_config {
+  std::shared_ptr<spdlog::logger> logger;
+  bool always_flush = false;
+};
 
-  switch (level) {
-    case spdlog::level::trace:
-      spdlog::trace("[{}] {}:{}: {}", location.module_name(),
-                    p.filename().string(), location.line(),
-                    fmt::format(fmt, std::forward<Args>(args)...));
-      break;
-    case spdlog::level::debug:
-      spdlog::debug("[{}] {}:{}: {}", location.module_name(),
-                    p.filename().string(), location.line(),
-                    fmt::format(fmt, std::forward<Args>(args)...));
-      break;
-    case spdlog::level::info:
-      spdlog::info("[{}] {}:{}: {}", location.module_name(),
-                   p.filename().string(), location.line(),
-                   fmt::format(fmt, std::forward<Args>(args)...));
-      break;
-    case spdlog::level::warn:
-      spdlog::warn("[{}] {}:{}: {}", location.module_name(),
-                   p.filename().string(), location.line(),
-                   fmt::format(fmt, std::forward<Args>(args)...));
-      break;
-    case spdlog::level::err:
-      spdlog::error("[{}] {}:{}: {}", location.module_name(),
-                    p.filename().string(), location.line(),
-                    fmt::format(fmt, std::forward<Args>(args)...));
-      break;
-    case spdlog::level::critical:
-      spdlog::critical("[{}] {}:{}: {}", location.module_name(),
-                       p.filename().string(), location.line(),
-                       fmt::format(fmt, std::forward<Args>(args)...));
-      break;
-    case spdlog::level::off:
-    case spdlog::level::n_levels:
-      break;
+// RCU for log_config: a reader announces the epoch it started in, then loads
+// the current config; a writer swaps the pointer, bumps the epoch and waits
+// for every reader of an older epoch before deleting the old config (and with
+// it, sinks no other config uses).
+// On linux the writer issues the full barrier for every thread
+// (membarrier), so a reader pays for a couple of plain stores.
+class config_domain {
+ public:
+  static config_domain& instance() {
+    // the default logger of the initial config lives in the registry
+    spdlog::details::registry::instance();
+    static config_domain domain;
+    return domain;
+  }
+
+  const log_config* acquire() {
+    auto& local = local_slot();
+    if (local.depth++ == 0) {
+      local.slot->epoch.store(epoch_.load(std::memory_order_acquire),
+                              std::memory_order_relaxed);
+      reader_fence();
+    }
+    return current_.load(std::memory_order_acquire);
+  }
+
+  void release() {
+    auto& local = local_slot();
+    if (--local.depth == 0)
+      local.slot->epoch.store(0, std::memory_order_release);
+  }
+
+  // update is applied to a copy of the current config
+  template <typename F>
+  void update(F&& update) {
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    auto next = new log_config(*current_.load(std::memory_order_relaxed));
+    update(*next);
+    auto old = current_.exchange(next, std::memory_order_acq_rel);
+    uint64_t epoch = epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+    writer_fence();
+
+    // a reader that announced an older epoch may still use the old config;
+    // a reader calling init_log() itself is its own reader, skip it
+    auto& local = local_slot();
+    for (auto slot = slots_.load(std::memory_order_acquire); slot;
+         slot = slot->next) {
+      if (slot == local.slot)
+        continue;
+      while (true) {
+        uint64_t e = slot->epoch.load(std::memory_order_acquire);
+        if (e == 0 || e >= epoch)
+          break;
+        std::this_thread::yield();
+      }
+    }
+    if (local.depth > 0)
+      retired_.emplace_back(old);
+    else
+      delete old;
+  }
+
+  ~config_domain() { delete current_.load(std::memory_order_relaxed); }
+
+ private:
+  struct alignas(64) reader_slot {
+    std::atomic<uint64_t> epoch = 0;  // 0 outside of a read section
+    std::atomic<bool> used = true;
+    reader_slot* next = nullptr;
+  };
+
+  struct thread_reader {
+    ~thread_reader() {
+      if (slot)
+        slot->used.store(false, std::memory_order_release);
+    }
+
+    reader_slot* slot = nullptr;
+    int depth = 0;
+  };
+
+  config_domain() {
+    current_ = new log_config{spdlog::default_logger(), false};
+#if defined(__linux__)
+    asymmetric_ = ::syscall(SYS_membarrier,
+                            MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                            0) == 0;
+#endif
   }
 
-  if (always_flush_) {
-    spdlog::default_logger()->flush();
+  thread_reader& local_slot() {
+    thread_local thread_reader local;
+    if (local.slot)
+      return local;
+
+    // slots are never freed, a thread that exited leaves its slot to the
+    // next one
+    for (auto slot = slots_.load(std::memory_order_acquire); slot;
+         slot = slot->next) {
+      bool used = false;
+      if (slot->used.compare_exchange_strong(used, true)) {
+        local.slot = slot;
+        return local;
+      }
+    }
+    auto slot = new reader_slot;
+    slot->next = slots_.load(std::memory_order_relaxed);
+    while (!slots_.compare_exchange_weak(slot->next, slot,
+                                         std::memory_order_release)) {
+    }
+    local.slot = slot;
+    return local;
+  }
+
+  void reader_fence() const {
+    if (asymmetric_)
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    else
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void writer_fence() const {
+#if defined(__linux__)
+    if (asymmetric_) {
+      ::syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+      return;
+    }
+#endif
+    std::atomic_thread_fence(std::memory_order_seq_cst);
   }
 
-  if (level == spdlog::level::critical) {
-    spdlog::default_logger()->flush();
-    std::exit(EXIT_FAILURE);
+  std::atomic<const log_config*> current_ = nullptr;
+  std::atomic<uint64_t> epoch_ = 1;
+  std::atomic<reader_slot*> slots_ = nullptr;
+  bool asymmetric_ = false;
+  std::mutex write_mtx_;
+  // configs replaced from inside a read section, kept until exit
+  std::vector<std::unique_ptr<const log_config>> retired_;
+};
+
+// a read section, as short as possible: init_log() waits for it
+class config_reader {
+ public:
+  config_reader() : config_(config_domain::instance().acquire()) {}
+  ~config_reader() { config_domain::instance().release(); }
+  config_reader(const config_reader&) = delete;
+  config_reader& operator=(const config_reader&) = delete;
+
+  const log_config* operator->() const { return config_; }
+
+ private:
+  const log_config* config_;
+};
+
+int64_t to_nanoseconds(int64_t ticks) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::duration(ticks))
+      .count();
+}
+
+int64_t now_ticks() {
+  return std::chrono::system_clock::now().time_since_epoch().count();
+}
+
+// the files easylog writes itself need their directory, as spdlog's file
+// sinks create theirs
+void create_log_dir(const std::string& dir) {
+  if (dir.empty())
+    return;
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+}
+
+void put_varint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
   }
+  out.push_back((char)value);
 }
 
-LogMessage::LogMessage(int level, source_location location)
-    : level_(level), location_(location) {}
+void put_string(std::string& out, std::string_view str) {
+  put_varint(out, str.size());
+  out.append(str);
+}
+
+// Writes the binary log file described in easylog.h, rotated like the text
+// file: easylog.blog, easylog.1.blog, ... Sites are numbered per file.
+class binary_sink {
+ public:
+  static binary_sink& instance() {
+    static binary_sink sink;
+    return sink;
+  }
+
+  // false if the file can't be opened
+  bool open(const easylog_options& options) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    close_file();
+    create_log_dir(options.log_dir);
+    base_name_ = options.log_dir;
+    if (!base_name_.empty() && base_name_.back() != '/' &&
+        base_name_.back() != '\\') {
+      base_name_.append("/");
+    }
+    base_name_.append(options.app_log_name);
+    max_size_ = options.max_size;
+    max_files_ = options.max_files;
+    open_file("ab");
+    enabled_ = file_ != nullptr;
+    return enabled_;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    enabled_ = false;
+    close_file();
+  }
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // a site is written once for each level it logs at
+  void write(const easylog::log_site& site, int level, int64_t time,
+             const char* args, size_t size) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (file_ == nullptr)
+      return;
+
+    begin_entry(time);
+    auto [it, added] = site_ids_.try_emplace({&site, level}, next_id_);
+    if (added) {
+      add_site(next_id_++, level, site.line, site.module_name,
+               site.file_name, site.format, {site.arg_types, site.arg_count});
+    }
+    add_record(it->second, time, {args, size});
+    end_entry();
+  }
+
+  // LOG() messages are records of a "{}" site with one string argument
+  void write_text(int level, source_location& location, int64_t time,
+                  std::string_view msg) {
+    static constexpr easylog::arg_type text_args[] = {
+        easylog::arg_type::string};
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (file_ == nullptr)
+      return;
+
+    begin_entry(time);
+    auto key = std::make_tuple(location.module_name(), location.file_name(),
+                               location.line(), level);
+    auto [it, added] = text_ids_.try_emplace(key, next_id_);
+    if (added) {
+      add_site(next_id_++, level, location.line(), location.module_name(),
+               location.file_name(), "{}", {text_args, 1});
+    }
+
+    args_.clear();
+    uint32_t len = (uint32_t)msg.size();
+    args_.append((const char*)&len, sizeof(len));
+    args_.append(msg);
+    add_record(it->second, time, args_);
+    end_entry();
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (file_)
+      fflush(file_);
+  }
+
+  ~binary_sink() { close_file(); }
+
+ private:
+  binary_sink() = default;
+
+  std::string file_name(int index) const {
+    if (index == 0)
+      return base_name_ + ".blog";
+    return base_name_ + "." + std::to_string(index) + ".blog";
+  }
+
+  void open_file(const char* mode) {
+    file_ = fopen(file_name(0).c_str(), mode);
+    if (file_ == nullptr) {
+      config_reader()->logger->error("[easylog] can't open {}",
+                                     file_name(0));
+      return;
+    }
+
+    setvbuf(file_, nullptr, _IOFBF, 256 * 1024);
+    fseek(file_, 0, SEEK_END);
+    written_ = ftell(file_);
+    header_written_ = false;
+    site_ids_.clear();
+    text_ids_.clear();
+    next_id_ = 0;
+  }
+
+  void close_file() {
+    if (file_) {
+      fclose(file_);
+      file_ = nullptr;
+    }
+  }
+
+  void rotate() {
+    close_file();
+    for (int i = max_files_; i > 0; i--) {
+      std::string src = file_name(i - 1);
+      std::string dest = file_name(i);
+      std::remove(dest.c_str());
+      std::rename(src.c_str(), dest.c_str());
+    }
+    open_file("wb");
+  }
+
+  void begin_entry(int64_t time) {
+    out_.clear();
+    if (!header_written_) {
+      // a file appended to holds several headers, each restarts the sites
+      int64_t ns = to_nanoseconds(time);
+      out_.append(easylog::binary::magic, sizeof(easylog::binary::magic));
+      uint32_t version = easylog::binary::version;
+      out_.append((const char*)&version, sizeof(version));
+      out_.append((const char*)&ns, sizeof(ns));
+      header_written_ = true;
+      last_time_ = ns;
+    }
+  }
+
+  void add_site(uint32_t id, int level, unsigned line,
+                std::string_view module_name, std::string_view file_name,
+                std::string_view format,
+                std::basic_string_view<easylog::arg_type> arg_types) {
+    out_.push_back((char)easylog::binary::site_tag);
+    put_varint(out_, id);
+    out_.push_back((char)level);
+    put_varint(out_, line);
+    put_string(out_, module_name);
+    put_string(out_, file_name);
+    put_string(out_, format);
+    put_varint(out_, arg_types.size());
+    for (auto type : arg_types) {
+      out_.push_back((char)type);
+    }
+  }
+
+  void add_record(uint32_t id, int64_t time, std::string_view args) {
+    time = to_nanoseconds(time);
+    int64_t delta = time - last_time_;
+    last_time_ = time;
+    out_.push_back((char)easylog::binary::record_tag);
+    put_varint(out_, id);
+    put_varint(out_, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    put_varint(out_, args.size());
+    out_.append(args);
+  }
+
+  void end_entry() {
+    fwrite(out_.data(), 1, out_.size(), file_);
+    written_ += out_.size();
+    if (config_reader()->always_flush)
+      fflush(file_);
+    if (max_size_ > 0 && written_ >= (size_t)max_size_)
+      rotate();
+  }
+
+  std::atomic<bool> enabled_ = false;
+  std::mutex mtx_;
+  FILE* file_ = nullptr;
+  std::string base_name_;
+  int max_size_ = 0;
+  int max_files_ = 0;
+  size_t written_ = 0;
+  bool header_written_ = false;
+  int64_t last_time_ = 0;
+  uint32_t next_id_ = 0;
+  std::map<std::pair<const easylog::log_site*, int>, uint32_t> site_ids_;
+  std::map<std::tuple<const char*, const char*, unsigned, int>, uint32_t>
+      text_ids_;
+  std::string out_;
+  std::string args_;
+};
+
+// attached to the spdlog logger so that every logger flush (always_flush,
+// flush_every, CRITICAL) also flushes the binary file
+class binary_flush_sink : public spdlog::sinks::sink {
+ public:
+  void log(const spdlog::details::log_msg&) override {}
+  void flush() override { binary_sink::instance().flush(); }
+  void set_pattern(const std::string&) override {}
+  void set_formatter(std::unique_ptr<spdlog::formatter>) override {}
+};
+
+// Single producer single consumer byte ring, records are variable sized and
+// 8-byte aligned. A record that doesn't fit before the end of the buffer is
+// preceded by a padding record filling the rest.
+class spsc_ring {
+ public:
+  struct record_header {
+    uint32_t size;  // including the header
+    uint8_t kind;
+    uint8_t level;
+    uint16_t reserved;
+    int64_t time;  // system_clock ticks
+  };
+
+  enum kind : uint8_t { padding, text, deferred };
+
+  explicit spsc_ring(size_t capacity) {
+    size_t cap = 4096;
+    while (cap < capacity)
+      cap <<= 1;
+    capacity_ = cap;
+    buf_ = std::make_unique<char[]>(cap);
+  }
+
+  size_t max_record_size() const { return capacity_ / 4; }
+
+  // producer side
+  char* reserve(size_t size) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t to_end = capacity_ - (head & (capacity_ - 1));
+    size_t need = size <= to_end ? size : to_end + size;
+    if (head + need - cached_tail_ > capacity_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head + need - cached_tail_ > capacity_)
+        return nullptr;
+    }
+
+    if (size > to_end) {
+      auto pad = reinterpret_cast<record_header*>(&buf_[head & (capacity_ - 1)]);
+      pad->size = (uint32_t)to_end;
+      pad->kind = padding;
+      head += to_end;
+    }
+
+    reserved_head_ = head;
+    return &buf_[head & (capacity_ - 1)];
+  }
+
+  void commit(size_t size) {
+    head_.store(reserved_head_ + size, std::memory_order_release);
+  }
+
+  // consumer side
+  record_header* front() {
+    while (true) {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      if (tail == cached_head_) {
+        cached_head_ = head_.load(std::memory_order_acquire);
+        if (tail == cached_head_)
+          return nullptr;
+      }
+
+      auto header = reinterpret_cast<record_header*>(&buf_[tail & (capacity_ - 1)]);
+      if (header->kind != padding)
+        return header;
+
+      tail_.store(tail + header->size, std::memory_order_release);
+    }
+  }
+
+  void pop(const record_header* header) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + header->size,
+                std::memory_order_release);
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  size_t capacity_;
+  std::unique_ptr<char[]> buf_;
+  alignas(64) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  size_t reserved_head_ = 0;
+  alignas(64) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+};
+
+struct text_record {
+  spsc_ring::record_header header;
+  const char* module_name;
+  const char* file_name;
+  uint32_t line;
+  uint32_t len;
+  char msg[];
+};
+
+// an ELOG() record, formatted by the background thread
+struct deferred_record {
+  spsc_ring::record_header header;
+  const easylog::log_site* site;
+  uint32_t args_size;
+  uint32_t reserved;
+  char args[];
+};
+
+constexpr size_t align8(size_t size) { return (size + 7) & ~size_t(7); }
+
+struct thread_buffer {
+  explicit thread_buffer(size_t capacity) : ring(capacity) {}
+
+  spsc_ring ring;
+  std::atomic<bool> closed = false;
+};
+
+class async_backend {
+ public:
+  static async_backend& instance() {
+    // the background thread writes to spdlog and the binary file until it is
+    // joined, so both must be destroyed after the backend
+    config_domain::instance();
+    binary_sink::instance();
+    static async_backend backend;
+    return backend;
+  }
+
+  void start(const easylog_options& options) {
+    buffer_size_ = options.async_buffer_size;
+    policy_ = options.async_overflow;
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!thd_.joinable()) {
+      stop_ = false;
+      thd_ = std::thread([this] { run(); });
+    }
+    enabled_ = true;
+  }
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void push(int level, source_location& location, std::string_view msg) {
+    auto& ring = local_buffer()->ring;
+    size_t max_len = ring.max_record_size() - sizeof(text_record);
+    if (msg.size() > max_len)
+      msg = msg.substr(0, max_len);
+
+    size_t size = align8(sizeof(text_record) + msg.size());
+    char* p = reserve(ring, size);
+    if (p == nullptr)
+      return;
+
+    auto record = reinterpret_cast<text_record*>(p);
+    record->header.size = (uint32_t)size;
+    record->header.kind = spsc_ring::text;
+    record->header.level = (uint8_t)level;
+    record->header.time = now_ticks();
+    record->module_name = location.module_name();
+    record->file_name = location.file_name();
+    record->line = location.line();
+    record->len = (uint32_t)msg.size();
+    memcpy(record->msg, msg.data(), msg.size());
+    ring.commit(size);
+  }
+
+  bool fits(size_t args_size) {
+    return align8(sizeof(deferred_record) + args_size) <=
+           local_buffer()->ring.max_record_size();
+  }
+
+  char* reserve_deferred(const easylog::log_site& site, int level,
+                         size_t args_size) {
+    auto& ring = local_buffer()->ring;
+    size_t size = align8(sizeof(deferred_record) + args_size);
+    char* p = reserve(ring, size);
+    if (p == nullptr)
+      return nullptr;
+
+    auto record = reinterpret_cast<deferred_record*>(p);
+    record->header.size = (uint32_t)size;
+    record->header.kind = spsc_ring::deferred;
+    record->header.level = (uint8_t)level;
+    record->header.time = now_ticks();
+    record->site = &site;
+    record->args_size = (uint32_t)args_size;
+    return record->args;
+  }
+
+  void commit_deferred(size_t args_size) {
+    local_buffer()->ring.commit(align8(sizeof(deferred_record) + args_size));
+  }
+
+  void disable() {
+    if (!enabled())
+      return;
+
+    flush();
+    enabled_ = false;
+  }
+
+  // wait until the background thread has written everything
+  void flush() {
+    if (!enabled())
+      return;
+
+    // pairs with the fence in run(): either the background thread sees our
+    // records in the loop we wait for, or we see that loop started earlier
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t target = loops_.load(std::memory_order_relaxed);
+    while (drained_.load(std::memory_order_acquire) <= target) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    config_reader()->logger->flush();
+  }
+
+  ~async_backend() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    if (thd_.joinable())
+      thd_.join();
+  }
+
+ private:
+  async_backend() = default;
+
+  thread_buffer* local_buffer() {
+    struct holder {
+      ~holder() {
+        if (buffer)
+          buffer->closed = true;
+      }
+      std::shared_ptr<thread_buffer> buffer;
+    };
+    thread_local holder local;
+    if (!local.buffer) {
+      local.buffer = std::make_shared<thread_buffer>(buffer_size_);
+      std::lock_guard<std::mutex> lock(mtx_);
+      buffers_.push_back(local.buffer);
+    }
+    return local.buffer.get();
+  }
+
+  char* reserve(spsc_ring& ring, size_t size) {
+    char* p = ring.reserve(size);
+    while (p == nullptr) {
+      if (policy_ != overflow_policy::block) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      std::this_thread::yield();
+      p = ring.reserve(size);
+    }
+    return p;
+  }
+
+  void run() {
+    std::vector<std::shared_ptr<thread_buffer>> buffers;
+    int idle = 0;
+    while (true) {
+      bool stop;
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop = stop_;
+        buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                      [](auto& b) {
+                                        return b->closed && b->ring.empty();
+                                      }),
+                       buffers_.end());
+        buffers = buffers_;
+      }
+
+      // every record pushed before this loop started is written when the
+      // loop ends
+      uint64_t loop = loops_.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      size_t count = 0;
+      for (auto& buffer : buffers) {
+        count += drain(buffer->ring);
+      }
+
+      report_dropped();
+      if (count > 0) {
+        config_reader config;
+        if (config->always_flush)
+          config->logger->flush();
+      }
+      drained_.store(loop + 1, std::memory_order_release);
+
+      if (stop)
+        break;
+
+      if (count > 0) {
+        idle = 0;
+      } else if (++idle < 64) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+      }
+    }
+
+    config_reader()->logger->flush();
+  }
+
+  size_t drain(spsc_ring& ring) {
+    size_t count = 0;
+    auto& binary = binary_sink::instance();
+    while (auto header = ring.front()) {
+      buf_.clear();
+      if (header->kind == spsc_ring::deferred) {
+        auto record = reinterpret_cast<deferred_record*>(header);
+        auto site = record->site;
+        if (binary.enabled()) {
+          binary.write(*site, header->level, header->time, record->args,
+                       record->args_size);
+        }
+        fmt::format_to(std::back_inserter(buf_), "[{}] {}:{}: ",
+                       site->module_name, site->file_name, site->line);
+        site->format_args(buf_, site->format, record->args);
+      } else {
+        auto record = reinterpret_cast<text_record*>(header);
+        if (binary.enabled()) {
+          source_location location(record->module_name, record->file_name,
+                                   "", record->line);
+          binary.write_text(header->level, location, header->time,
+                            std::string_view(record->msg, record->len));
+        }
+        fmt::format_to(std::back_inserter(buf_), "[{}] {}:{}: {}",
+                       record->module_name, record->file_name, record->line,
+                       std::string_view(record->msg, record->len));
+      }
+      spdlog::log_clock::time_point time{
+          spdlog::log_clock::duration(header->time)};
+      config_reader()->logger->log(
+          time, spdlog::source_loc{}, (spdlog::level::level_enum)header->level,
+          spdlog::string_view_t(buf_.data(), buf_.size()));
+      ring.pop(header);
+      count++;
+    }
+    return count;
+  }
+
+  void report_dropped() {
+    if (policy_ != overflow_policy::count_and_drop)
+      return;
+
+    uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      config_reader()->logger->warn(
+          "[easylog] dropped {} messages, the async buffer is full", dropped);
+    }
+  }
+
+  std::atomic<bool> enabled_ = false;
+  std::atomic<size_t> buffer_size_ = 1024 * 1024;
+  std::atomic<overflow_policy> policy_ = overflow_policy::block;
+  std::atomic<uint64_t> dropped_ = 0;
+  std::atomic<uint64_t> loops_ = 0;
+  std::atomic<uint64_t> drained_ = 0;
+
+  std::mutex mtx_;
+  bool stop_ = false;
+  std::vector<std::shared_ptr<thread_buffer>> buffers_;
+  std::thread thd_;
+  fmt::memory_buffer buf_;
+};
+}  // namespace
+
+namespace {
+// Flight recorder file, all in one mmap:
+//   flight_header, the site table, then flight_threads slots of
+//   flight_slot + a ring of flight_records
+// A killed process leaves it complete in the page cache.
+constexpr char flight_magic[8] = {'E', 'A', 'S', 'Y', 'L', 'O', 'G', 'F'};
+constexpr uint32_t flight_version = 1;
+constexpr size_t flight_sites_size = 1024 * 1024;
+
+struct flight_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slot_count;
+  uint64_t slot_size;  // including the flight_slot
+  uint64_t sites_offset;
+  uint64_t sites_size;
+  uint64_t slots_offset;
+  std::atomic<uint64_t> sites_used;
+};
+
+struct flight_slot {
+  std::atomic<uint32_t> owned;
+  uint32_t tid;
+  std::atomic<uint64_t> head;  // bytes ever written
+  std::atomic<uint64_t> tail;  // oldest complete record
+  char reserved[40];
+};
+static_assert(sizeof(flight_slot) == 64);
+
+// a call site, id is its offset in the site table + 1
+struct flight_site {
+  uint32_t size;
+  std::atomic<uint32_t> ready;
+  uint32_t line;
+  uint16_t arg_count;
+  uint16_t module_len;
+  uint16_t file_len;
+  uint16_t format_len;
+  // arg_types, module, file, format
+};
+
+struct flight_record {
+  uint32_t size;  // 8-byte aligned, including the header
+  uint32_t site;  // 0 for padding up to the end of the ring
+  int64_t time;   // nanoseconds since the epoch
+  uint32_t args_size;
+  uint8_t level;
+  uint8_t reserved[3];
+  char args[];
+};
+
+class flight_recorder {
+ public:
+  static flight_recorder& instance() {
+    static flight_recorder recorder;
+    return recorder;
+  }
+
+  bool open(const easylog_options& options) {
+#ifdef _WIN32
+    return false;
+#else
+    std::lock_guard<std::mutex> lock(mtx_);
+    create_log_dir(options.log_dir);
+    std::string dir = options.log_dir;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+      dir.append("/");
+    dump_name_ = dir + options.app_log_name + ".flight.log";
+    std::string name = dir + options.app_log_name + ".flight";
+
+    size_t ring = 4096;
+    while (ring * 2 <= (size_t)std::max(options.flight_recorder_size, 4096))
+      ring *= 2;
+    uint32_t slots = (uint32_t)std::max(options.flight_recorder_threads, 1);
+    size_t slots_offset = 4096 + flight_sites_size;
+    size_t size = slots_offset + slots * (sizeof(flight_slot) + ring);
+
+    // the same file again: keep recording into it
+    if (!files_.empty()) {
+      auto& last = files_.back();
+      if (last->name == name && last->size == size &&
+          last->ring_size == ring) {
+        current_.store(last.get(), std::memory_order_release);
+        return true;
+      }
+    }
+
+    // threads may still write to the old file's mapping, truncating it would
+    // fault them; it is unlinked and a new file takes the name
+    ::unlink(name.c_str());
+    int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+      if (fd >= 0)
+        ::close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return false;
+
+    auto header = new (p) flight_header{};
+    memcpy(header->magic, flight_magic, sizeof(flight_magic));
+    header->version = flight_version;
+    header->slot_count = slots;
+    header->slot_size = sizeof(flight_slot) + ring;
+    header->sites_offset = 4096;
+    header->sites_size = flight_sites_size;
+    header->slots_offset = slots_offset;
+
+    // threads may still write to an old mapping, it is never unmapped
+    auto file = std::make_unique<mapped_file>();
+    file->name = name;
+    file->crash_name = name + ".crash";
+    file->base = static_cast<char*>(p);
+    file->size = size;
+    file->header = header;
+    file->ring_size = ring;
+    file->epoch = (uint32_t)files_.size() + 1;
+    current_.store(file.get(), std::memory_order_release);
+    files_.push_back(std::move(file));
+    return true;
+#endif
+  }
+
+  void close() { current_.store(nullptr, std::memory_order_release); }
+
+  char* reserve(easylog::site_filter& filter, int level,
+                const char* module_name, const char* file_name, unsigned line,
+                std::string_view format, const easylog::arg_type* arg_types,
+                size_t arg_count, size_t args_size) {
+    auto& local = local_slot();
+    if (local.slot == nullptr)
+      return nullptr;
+
+    uint64_t id = filter.flight_id();
+    if ((id >> 32) != local.file->epoch) {
+      id = add_site(*local.file, module_name, file_name, line, format,
+                    arg_types, arg_count);
+      if (id == 0)
+        return nullptr;
+      filter.set_flight_id(id);
+    }
+
+    size_t ring = local.file->ring_size;
+    size_t size = (sizeof(flight_record) + args_size + 7) & ~size_t(7);
+    if (size > ring / 4)
+      return nullptr;
+
+    auto slot = local.slot;
+    uint64_t head = slot->head.load(std::memory_order_relaxed);
+    size_t pos = head & (ring - 1);
+    size_t to_end = ring - pos;
+    size_t need = size <= to_end ? size : to_end + size;
+    uint64_t tail = slot->tail.load(std::memory_order_relaxed);
+    while (head + need - tail > ring) {
+      uint32_t record_size = record_at(local, tail)->size;
+      if (record_size == 0 || record_size > ring || record_size % 8 != 0) {
+        // overwritten behind our back, start the ring over
+        tail = head;
+        break;
+      }
+      tail += record_size;
+    }
+    slot->tail.store(tail, std::memory_order_release);
+
+    if (size > to_end) {
+      auto pad = record_at(local, head);
+      pad->size = (uint32_t)to_end;
+      pad->site = 0;
+      head += to_end;
+    }
+
+    auto record = record_at(local, head);
+    record->size = (uint32_t)size;
+    record->site = (uint32_t)id;
+    record->time = to_nanoseconds(now_ticks());
+    record->args_size = (uint32_t)args_size;
+    record->level = (uint8_t)level;
+    local.pending_head = head + size;
+    return record->args;
+  }
+
+  void commit() {
+    auto& local = local_slot();
+    local.slot->head.store(local.pending_head, std::memory_order_release);
+  }
+
+  // decodes the rings as text, not for signal handlers
+  void dump() {
+    auto file = current_.load(std::memory_order_acquire);
+    if (file == nullptr)
+      return;
+
+    fmt::memory_buffer out;
+    easylog::decode_flight_recorder(std::string_view(file->base, file->size),
+                                    out);
+    if (FILE* f = fopen(dump_name_.c_str(), "wb")) {
+      fwrite(out.data(), 1, out.size(), f);
+      fclose(f);
+    }
+  }
+
+  // only async-signal-safe calls: the mapping is flushed and copied as is to
+  // <app_log_name>.flight.crash, which easylog_decoder reads like the .flight
+  // file the next open() replaces
+  void dump_from_signal() {
+#ifndef _WIN32
+    auto file = current_.load(std::memory_order_acquire);
+    if (file == nullptr)
+      return;
+
+    ::msync(file->base, file->size, MS_SYNC);
+    int fd = ::open(file->crash_name.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return;
+    const char* data = file->base;
+    size_t left = file->size;
+    while (left > 0) {
+      ssize_t n = ::write(fd, data, left);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      data += n;
+      left -= (size_t)n;
+    }
+    ::close(fd);
+#endif
+  }
+
+  bool active() const {
+    return current_.load(std::memory_order_relaxed) != nullptr;
+  }
+
+ private:
+  struct mapped_file {
+    std::string name;
+    std::string crash_name;
+    char* base;
+    size_t size;
+    flight_header* header;
+    size_t ring_size;
+    uint32_t epoch;
+  };
+
+  struct thread_slot {
+    ~thread_slot() {
+      if (slot)
+        slot->owned.store(0, std::memory_order_release);
+    }
+
+    mapped_file* file = nullptr;
+    flight_slot* slot = nullptr;
+    uint64_t pending_head = 0;
+  };
+
+  flight_recorder() = default;
+
+  static flight_record* record_at(thread_slot& local, uint64_t offset) {
+    return reinterpret_cast<flight_record*>(
+        reinterpret_cast<char*>(local.slot + 1) +
+        (offset & (local.file->ring_size - 1)));
+  }
+
+  thread_slot& local_slot() {
+    thread_local thread_slot local;
+    auto file = current_.load(std::memory_order_acquire);
+    if (local.file == file)
+      return local;
+
+    if (local.slot)
+      local.slot->owned.store(0, std::memory_order_release);
+    local.file = file;
+    local.slot = nullptr;
+    if (file == nullptr)
+      return local;
+
+    // unused slots first; a thread that exited leaves its slot (and its
+    // records) to a later one once they run out
+    auto header = file->header;
+    for (int pass = 0; pass < 2 && local.slot == nullptr; pass++) {
+      for (uint32_t i = 0; i < header->slot_count; i++) {
+        auto slot = reinterpret_cast<flight_slot*>(
+            file->base + header->slots_offset + i * header->slot_size);
+        uint32_t expected = 0;
+        if (pass == 0 && slot->head.load(std::memory_order_relaxed) != 0)
+          continue;
+        if (slot->owned.compare_exchange_strong(expected, 1)) {
+          slot->tid = (uint32_t)syscall_tid();
+          local.slot = slot;
+          break;
+        }
+      }
+    }
+    return local;
+  }
+
+  static long syscall_tid() {
+#if defined(__linux__)
+    return ::syscall(SYS_gettid);
+#else
+    return 0;
+#endif
+  }
+
+  uint64_t add_site(mapped_file& file, const char* module_name,
+                    const char* file_name, unsigned line,
+                    std::string_view format,
+                    const easylog::arg_type* arg_types, size_t arg_count) {
+    size_t module_len = strlen(module_name);
+    size_t file_len = strlen(file_name);
+    size_t size = (sizeof(flight_site) + arg_count + module_len + file_len +
+                   format.size() + 7) &
+                  ~size_t(7);
+    auto header = file.header;
+    uint64_t offset =
+        header->sites_used.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size > header->sites_size)
+      return 0;
+
+    // two threads may add the same site, both entries are valid
+    auto site = new (file.base + header->sites_offset + offset) flight_site{};
+    site->size = (uint32_t)size;
+    site->line = line;
+    site->arg_count = (uint16_t)arg_count;
+    site->module_len = (uint16_t)module_len;
+    site->file_len = (uint16_t)file_len;
+    site->format_len = (uint16_t)format.size();
+    char* p = reinterpret_cast<char*>(site + 1);
+    memcpy(p, arg_types, arg_count);
+    p += arg_count;
+    memcpy(p, module_name, module_len);
+    p += module_len;
+    memcpy(p, file_name, file_len);
+    p += file_len;
+    memcpy(p, format.data(), format.size());
+    site->ready.store(1, std::memory_order_release);
+    return (uint64_t(file.epoch) << 32) | (offset + 1);
+  }
+
+  std::mutex mtx_;
+  std::atomic<mapped_file*> current_ = nullptr;
+  std::vector<std::unique_ptr<mapped_file>> files_;
+  std::string dump_name_;
+};
+
+const int fatal_signals[] = {SIGSEGV, SIGFPE, SIGILL, SIGABRT,
+#ifdef SIGBUS
+                             SIGBUS
+#endif
+};
+
+void on_fatal_signal(int sig) {
+  static std::atomic<bool> dumping = false;
+  if (!dumping.exchange(true))
+    flight_recorder::instance().dump_from_signal();
+
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+void install_signal_handlers() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    for (int sig : fatal_signals) {
+      signal(sig, on_fatal_signal);
+    }
+  });
+}
+
+// LOG(CRITICAL) ends the process
+[[noreturn]] void exit_on_critical() {
+  config_reader()->logger->flush();
+  flight_recorder::instance().dump();
+  std::exit(EXIT_FAILURE);
+}
+}  // namespace
+
+namespace {
+class log_streambuf : public std::streambuf {
+ public:
+  fmt::memory_buffer buf;
+
+ protected:
+  int_type overflow(int_type ch) override {
+    if (ch != traits_type::eof())
+      buf.push_back((char)ch);
+    return ch;
+  }
+
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    buf.append(s, s + n);
+    return n;
+  }
+};
+
+struct log_stream {
+  log_streambuf sb;
+  std::ostream os{&sb};
+};
+
+// a LOG() inside the arguments of another LOG() gets the next stream
+struct log_stream_stack {
+  std::vector<std::unique_ptr<log_stream>> streams;
+  size_t depth = 0;
+};
+
+thread_local log_stream_stack local_streams;
+
+log_stream& acquire_stream() {
+  auto& stack = local_streams;
+  if (stack.depth == stack.streams.size()) {
+    stack.streams.push_back(std::make_unique<log_stream>());
+  }
+
+  auto& stream = *stack.streams[stack.depth++];
+  stream.sb.buf.clear();
+  auto& os = stream.os;
+  os.clear();
+  os.flags(std::ios_base::dec | std::ios_base::skipws);
+  os.precision(6);
+  os.width(0);
+  os.fill(' ');
+  return stream;
+}
+
+void release_stream() { local_streams.depth--; }
+
+void log_line(int level, std::string_view line) {
+  {
+    config_reader config;
+    config->logger->log((spdlog::level::level_enum)level,
+                        spdlog::string_view_t(line.data(), line.size()));
+    if (config->always_flush)
+      config->logger->flush();
+  }
+
+  if (level == CRITICAL) {
+    exit_on_critical();
+  }
+}
+
+// LOG() text is a record of a "{}" site with one string argument
+void flight_text(int level, easylog::site_filter& site,
+                 source_location& location, std::string_view msg) {
+  static constexpr easylog::arg_type text_args[] = {
+      easylog::arg_type::string};
+
+  msg = msg.substr(0, 1024);
+  uint32_t len = (uint32_t)msg.size();
+  char* data = flight_recorder::instance().reserve(
+      site, level, location.module_name(), location.file_name(),
+      location.line(), "{}", text_args, 1, sizeof(len) + len);
+  if (data == nullptr)
+    return;
+
+  memcpy(data, &len, sizeof(len));
+  memcpy(data + sizeof(len), msg.data(), len);
+  flight_recorder::instance().commit();
+}
+}  // namespace
+
+LogMessage::LogMessage(int level, source_location location,
+                       easylog::site_filter* site)
+    : level_(level),
+      location_(location),
+      site_(site),
+      prefix_len_(0),
+      output_(true) {
+  if (site_ && easylog::flight_active.load(std::memory_order_relaxed)) {
+    output_ = easylog::should_output(level, *site_, location_.module_name(),
+                                     location_.file_name(), location_.line());
+  }
+
+  auto& stream = acquire_stream();
+  os_ = &stream.os;
+  if (output_ && !async_backend::instance().enabled()) {
+    // the sync path logs the whole line, the async backend adds the prefix
+    fmt::format_to(std::back_inserter(stream.sb.buf), "[{}] {}:{}: ",
+                   location_.module_name(), location_.file_name(),
+                   location_.line());
+    prefix_len_ = stream.sb.buf.size();
+  }
+}
 
 LogMessage::~LogMessage() {
-  log((spdlog::level::level_enum)level_, location_, "{}", os_.str());
+  auto& buf = local_streams.streams[local_streams.depth - 1]->sb.buf;
+  std::string_view line(buf.data(), buf.size());
+  if (site_ && easylog::flight_active.load(std::memory_order_relaxed)) {
+    flight_text(level_, *site_, location_, line.substr(prefix_len_));
+  }
+  if (!output_) {
+    release_stream();
+    return;
+  }
+
+  auto& backend = async_backend::instance();
+  if (backend.enabled()) {
+    backend.push(level_, location_, line.substr(prefix_len_));
+    release_stream();
+    if (level_ == CRITICAL) {
+      backend.flush();
+      exit_on_critical();
+    }
+    return;
+  }
+
+  auto& binary = binary_sink::instance();
+  if (binary.enabled()) {
+    binary.write_text(level_, location_, now_ticks(),
+                      line.substr(prefix_len_));
+  }
+
+  if (prefix_len_ == 0) {
+    // async mode was turned off after this message started
+    fmt::memory_buffer full;
+    fmt::format_to(std::back_inserter(full), "[{}] {}:{}: {}",
+                   location_.module_name(), location_.file_name(),
+                   location_.line(), line);
+    release_stream();
+    log_line(level_, std::string_view(full.data(), full.size()));
+    return;
+  }
+
+  // copy-free: the line stays in the stream buffer until spdlog has it
+  log_line(level_, line);
+  release_stream();
+}
+
+namespace easylog {
+namespace {
+// arguments packed on the calling thread: sync mode with the binary file, or
+// a record too large for the async buffer
+struct packed_args {
+  std::vector<char> buf;
+  bool in_use = false;
+};
+
+thread_local packed_args local_packed;
+}  // namespace
+
+bool deferred_enabled() {
+  return async_backend::instance().enabled() ||
+         binary_sink::instance().enabled();
 }
 
+char* reserve_record(const log_site& site, int level, size_t size) {
+  auto& backend = async_backend::instance();
+  if (backend.enabled() && backend.fits(size)) {
+    local_packed.in_use = false;
+    return backend.reserve_deferred(site, level, size);
+  }
+
+  local_packed.in_use = true;
+  local_packed.buf.resize(std::max<size_t>(size, 1));
+  return local_packed.buf.data();
+}
+
+void commit_record(const log_site& site, int level, size_t size) {
+  if (!local_packed.in_use) {
+    auto& backend = async_backend::instance();
+    backend.commit_deferred(size);
+    if (level == CRITICAL) {
+      backend.flush();
+      exit_on_critical();
+    }
+    return;
+  }
+
+  const char* data = local_packed.buf.data();
+  auto& binary = binary_sink::instance();
+  if (binary.enabled()) {
+    binary.write(site, level, now_ticks(), data, size);
+  }
+
+  auto& stream = acquire_stream();
+  auto& buf = stream.sb.buf;
+  fmt::format_to(std::back_inserter(buf), "[{}] {}:{}: ", site.module_name,
+                 site.file_name, site.line);
+  site.format_args(buf, site.format, data);
+  log_line(level, std::string_view(buf.data(), buf.size()));
+  release_stream();
+}
+
+void log_sync(const log_site& site, int level, fmt::format_args args) {
+  auto& stream = acquire_stream();
+  auto& buf = stream.sb.buf;
+  fmt::format_to(std::back_inserter(buf), "[{}] {}:{}: ", site.module_name,
+                 site.file_name, site.line);
+  fmt::vformat_to(std::back_inserter(buf),
+                  fmt::string_view(site.format.data(), site.format.size()),
+                  args);
+  log_line(level, std::string_view(buf.data(), buf.size()));
+  release_stream();
+}
+
+char* flight_reserve(site_filter& filter, const log_site& site, int level,
+                     size_t size) {
+  return flight_recorder::instance().reserve(
+      filter, level, site.module_name, site.file_name, site.line,
+      site.format, site.arg_types, site.arg_count, size);
+}
+
+void flight_commit() { flight_recorder::instance().commit(); }
+
+bool format_packed_args(fmt::memory_buffer& buf, std::string_view format,
+                        const arg_type* arg_types, size_t arg_count,
+                        std::string_view args) {
+  const char* p = args.data();
+  const char* end = p + args.size();
+  auto take = [&](auto& value) {
+    if ((size_t)(end - p) < sizeof(value))
+      return false;
+    memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+    return true;
+  };
+
+  fmt::dynamic_format_arg_store<fmt::format_context> store;
+  for (size_t i = 0; i < arg_count; i++) {
+    bool ok = false;
+    switch (arg_types[i]) {
+      case arg_type::i64: {
+        int64_t v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      case arg_type::u64: {
+        uint64_t v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      case arg_type::f32: {
+        float v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      case arg_type::f64: {
+        double v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      case arg_type::boolean: {
+        bool v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      case arg_type::character: {
+        char v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      case arg_type::string: {
+        uint32_t len;
+        ok = take(len) && (size_t)(end - p) >= len;
+        if (ok) {
+          store.push_back(std::string_view(p, len));
+          p += len;
+        }
+        break;
+      }
+      case arg_type::pointer: {
+        const void* v;
+        ok = take(v);
+        if (ok)
+          store.push_back(v);
+        break;
+      }
+      default:
+        break;
+    }
+    if (!ok)
+      return false;
+  }
+
+  try {
+    fmt::vformat_to(std::back_inserter(buf),
+                    fmt::string_view(format.data(), format.size()), store);
+  } catch (const fmt::format_error& e) {
+    fmt::format_to(std::back_inserter(buf), "<{}: {}>", e.what(), format);
+  }
+  return true;
+}
+
+namespace {
+void format_record_prefix(fmt::memory_buffer& out, int64_t time_ns, int level,
+                          std::string_view module_name,
+                          std::string_view file_name, unsigned line) {
+  // same layout as "[%m-%d %H:%M:%S.%e][%l] " plus the LOG() prefix
+  static constexpr std::string_view level_names[] = {
+      "trace", "debug", "info", "warning", "error", "critical", "off"};
+
+  time_t secs = (time_t)(time_ns / 1000000000);
+  int ms = (int)(time_ns % 1000000000 / 1000000);
+  std::tm tm{};
+#ifdef _WIN32
+  localtime_s(&tm, &secs);
+#else
+  localtime_r(&secs, &tm);
+#endif
+  fmt::format_to(std::back_inserter(out),
+                 "[{:02}-{:02} {:02}:{:02}:{:02}.{:03}][{}] [{}] {}:{}: ",
+                 tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                 ms, level_names[std::clamp(level, 0, OFF)], module_name,
+                 file_name, line);
+}
+}  // namespace
+
+bool decode_flight_recorder(std::string_view file, fmt::memory_buffer& out) {
+  if (file.size() < sizeof(flight_header) ||
+      memcmp(file.data(), flight_magic, sizeof(flight_magic)) != 0) {
+    return false;
+  }
+
+  auto header = reinterpret_cast<const flight_header*>(file.data());
+  if (header->version != flight_version ||
+      header->sites_offset + header->sites_size > file.size() ||
+      header->slots_offset + header->slot_count * header->slot_size >
+          file.size() ||
+      header->slot_size <= sizeof(flight_slot)) {
+    return false;
+  }
+
+  struct site_info {
+    const flight_site* site;
+    const arg_type* arg_types;
+    std::string_view module_name;
+    std::string_view file_name;
+    std::string_view format;
+  };
+  std::unordered_map<uint32_t, site_info> sites;
+  const char* table = file.data() + header->sites_offset;
+  uint64_t used = std::min<uint64_t>(
+      header->sites_used.load(std::memory_order_acquire), header->sites_size);
+  for (uint64_t offset = 0; offset + sizeof(flight_site) <= used;) {
+    auto site = reinterpret_cast<const flight_site*>(table + offset);
+    if (site->size < sizeof(flight_site) || offset + site->size > used)
+      break;
+    if (site->ready.load(std::memory_order_acquire)) {
+      const char* p = reinterpret_cast<const char*>(site + 1);
+      auto arg_types = reinterpret_cast<const arg_type*>(p);
+      p += site->arg_count;
+      std::string_view module_name(p, site->module_len);
+      p += site->module_len;
+      std::string_view file_name(p, site->file_len);
+      p += site->file_len;
+      std::string_view format(p, site->format_len);
+      sites.emplace((uint32_t)(offset + 1),
+                    site_info{site, arg_types, module_name, file_name, format});
+    }
+    offset += site->size;
+  }
+
+  struct entry {
+    const flight_record* record;
+    const site_info* site;
+  };
+  std::vector<entry> entries;
+  size_t ring = header->slot_size - sizeof(flight_slot);
+  for (uint32_t i = 0; i < header->slot_count; i++) {
+    auto slot = reinterpret_cast<const flight_slot*>(
+        file.data() + header->slots_offset + i * header->slot_size);
+    const char* base = reinterpret_cast<const char*>(slot + 1);
+    uint64_t head = slot->head.load(std::memory_order_acquire);
+    uint64_t tail = slot->tail.load(std::memory_order_acquire);
+    if (head < tail || head - tail > ring)
+      continue;
+
+    while (tail < head) {
+      auto record =
+          reinterpret_cast<const flight_record*>(base + tail % ring);
+      if (record->size < sizeof(uint64_t) || record->size > head - tail ||
+          tail % ring + record->size > ring) {
+        break;
+      }
+      tail += record->size;
+      if (record->site == 0)
+        continue;
+      auto it = sites.find(record->site);
+      if (it != sites.end() &&
+          sizeof(flight_record) + record->args_size <= record->size) {
+        entries.push_back({record, &it->second});
+      }
+    }
+  }
+
+  std::stable_sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+    return a.record->time < b.record->time;
+  });
+  for (auto& e : entries) {
+    auto& site = *e.site;
+    format_record_prefix(out, e.record->time, e.record->level,
+                         site.module_name, site.file_name, site.site->line);
+    if (!format_packed_args(out, site.format, site.arg_types,
+                            site.site->arg_count,
+                            {e.record->args, e.record->args_size})) {
+      fmt::format_to(std::back_inserter(out), "<bad record>");
+    }
+    out.push_back('\n');
+  }
+  return true;
+}
+}  // namespace easylog
+
+namespace {
+// log_rule tables, only read when a call site sees a new rule_generation
+struct rule_table {
+  std::mutex mtx;
+  int global_level = TRACE;
+  int flight_level = OFF;  // what the flight recorder captures
+  std::map<std::string, easylog::log_rule, std::less<>> modules;
+  std::map<std::string, easylog::log_rule, std::less<>> files;
+  std::map<std::string, easylog::log_rule, std::less<>> sites;  // file:line
+};
+
+rule_table& log_rules() {
+  static rule_table table;
+  return table;
+}
+
+std::string site_key(std::string_view file_name, unsigned line) {
+  return fmt::format("{}:{}", file_name, line);
+}
+
+// called with the table locked: let the lowest level through min_level and
+// the logger (min_level also lets through what the flight recorder wants), then make every call site resolve its rule again
+void apply_rules(rule_table& table) {
+  int level = table.global_level;
+  for (auto rules : {&table.modules, &table.files, &table.sites}) {
+    for (auto& [name, rule] : *rules) {
+      if (rule.level >= 0)
+        level = std::min(level, rule.level);
+    }
+  }
+
+  easylog::output_level = level;
+  easylog::min_level = std::min(level, table.flight_level);
+  config_reader()->logger->set_level((spdlog::level::level_enum)level);
+  easylog::rules_active = !table.modules.empty() || !table.files.empty() ||
+                          !table.sites.empty();
+  easylog::rule_generation.fetch_add(1, std::memory_order_release);
+}
+}  // namespace
+
+namespace easylog {
+void set_module_rule(std::string_view module_name, log_rule rule) {
+  auto& table = log_rules();
+  std::lock_guard<std::mutex> lock(table.mtx);
+  table.modules.insert_or_assign(std::string(module_name), rule);
+  apply_rules(table);
+}
+
+void set_file_rule(std::string_view file_name, log_rule rule) {
+  auto& table = log_rules();
+  std::lock_guard<std::mutex> lock(table.mtx);
+  table.files.insert_or_assign(std::string(file_name), rule);
+  apply_rules(table);
+}
+
+void set_site_rule(std::string_view file_name, unsigned line, log_rule rule) {
+  auto& table = log_rules();
+  std::lock_guard<std::mutex> lock(table.mtx);
+  table.sites.insert_or_assign(site_key(file_name, line), rule);
+  apply_rules(table);
+}
+
+void clear_log_rules() {
+  auto& table = log_rules();
+  std::lock_guard<std::mutex> lock(table.mtx);
+  table.modules.clear();
+  table.files.clear();
+  table.sites.clear();
+  apply_rules(table);
+}
+
+void site_filter::resolve(uint64_t generation, const char* module_name,
+                          const char* file_name, unsigned line) {
+  int level;
+  uint32_t sample_one_in = 0;
+  double rate = 0;
+  double burst = 1;
+  {
+    auto& table = log_rules();
+    std::lock_guard<std::mutex> lock(table.mtx);
+    level = table.global_level;
+    auto merge = [&](auto& rules, std::string_view key) {
+      auto it = rules.find(key);
+      if (it == rules.end())
+        return;
+
+      auto& rule = it->second;
+      if (rule.level >= 0)
+        level = rule.level;
+      if (rule.sample_one_in > 0)
+        sample_one_in = rule.sample_one_in;
+      if (rule.rate_per_second > 0) {
+        rate = rule.rate_per_second;
+        burst = rule.burst;
+      }
+    };
+    merge(table.modules, module_name);
+    merge(table.files, file_name);
+    if (!table.sites.empty())
+      merge(table.sites, site_key(file_name, line));
+  }
+
+  int64_t interval = 0;
+  if (rate > 0)
+    interval = std::max<int64_t>(1, (int64_t)(1e9 / rate));
+  level_.store(level, std::memory_order_relaxed);
+  sample_one_in_.store(sample_one_in, std::memory_order_relaxed);
+  interval_ns_.store(interval, std::memory_order_relaxed);
+  tolerance_ns_.store((int64_t)(interval * (std::max(burst, 1.0) - 1)),
+                      std::memory_order_relaxed);
+  generation_.store(generation, std::memory_order_release);
+}
+
+bool site_filter::take_token(int64_t interval) {
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  int64_t tolerance = tolerance_ns_.load(std::memory_order_relaxed);
+  int64_t arrival = arrival_ns_.load(std::memory_order_relaxed);
+  while (true) {
+    int64_t start = std::max(arrival, now);
+    if (start - now > tolerance)
+      return false;
+    if (arrival_ns_.compare_exchange_weak(arrival, start + interval,
+                                          std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+}
+}  // namespace easylog
+
 std::vector<spdlog::sink_ptr> get_sinks(const easylog_options& options) {
   std::vector<spdlog::sink_ptr> sinks;
 
@@ -93,10 +1776,16 @@ std::vector<spdlog::sink_ptr> get_sinks(const easylog_options& options) {
 }
 
 std::shared_ptr<spdlog::logger> create_logger(const easylog_options& options) {
-  static std::map<std::string, std::shared_ptr<spdlog::logger>> logger_map;
+  // a logger lives as long as a config uses it, its sinks close when the
+  // last one is retired
+  static std::mutex mtx;
+  static std::map<std::string, std::weak_ptr<spdlog::logger>> logger_map;
+  std::lock_guard<std::mutex> lock(mtx);
 
-  if (logger_map.find(options.id) != logger_map.end()) {
-    return logger_map[options.id];
+  std::string key = options.binary ? options.id + ".blog" : options.id;
+  if (auto it = logger_map.find(key); it != logger_map.end()) {
+    if (auto logger = it->second.lock())
+      return logger;
   }
 
   static auto console_sink =
@@ -104,45 +1793,97 @@ std::shared_ptr<spdlog::logger> create_logger(const easylog_options& options) {
 //  console_sink->set_level((spdlog::level::level_enum)options.log_level);
   console_sink->set_pattern("[%m-%d %H:%M:%S.%e][%l] %v");
 
-  std::string filename = options.log_dir;
-  std::string name = options.app_log_name;
-  name.append(".log");
-  if (filename.back() != '/' && filename.back() != '\\') {
-    filename.append("/");
+  std::vector<std::shared_ptr<spdlog::sinks::sink>> sinks = {console_sink};
+  if (options.binary) {
+    sinks.push_back(std::make_shared<binary_flush_sink>());
+  } else {
+    std::string filename = options.log_dir;
+    std::string name = options.app_log_name;
+    name.append(".log");
+    if (filename.back() != '/' && filename.back() != '\\') {
+      filename.append("/");
+    }
+    filename.append(name);
+    spdlog::sink_ptr file_sink;
+    if (options.uring_file) {
+      file_sink = std::make_shared<spdlog::sinks::uring_file_sink_mt>(
+          filename, options.max_size, options.max_files);
+    } else {
+      file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+          filename, options.max_size, options.max_files);
+    }
+    file_sink->set_pattern("[%m-%d %H:%M:%S.%e][%l] %v");
+    sinks.push_back(file_sink);
   }
-  filename.append(name);
-  auto file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
-      filename, options.max_size, options.max_files);
-  file_sink->set_pattern("[%m-%d %H:%M:%S.%e][%l] %v");
-
-  std::vector<std::shared_ptr<spdlog::sinks::sink>> sinks = {console_sink,
-                                                             file_sink};
 
   auto logger = std::make_shared<spdlog::logger>(options.id, sinks.begin(),
                                                  sinks.end());
 
-  logger_map[options.id] = logger;
+  logger_map[key] = logger;
 
   return logger;
 }
 
 void init_log(easylog_options options, bool over_write) {
+  // messages still in the async buffers go to the old sinks
+  async_backend::instance().flush();
+  config_reader()->logger->flush();
 
-  spdlog::default_logger()->flush();
+  // without its file the binary log falls back to the text one
+  if (options.binary && !binary_sink::instance().open(options)) {
+    options.binary = false;
+  }
+  if (!options.binary) {
+    binary_sink::instance().close();
+  }
+
+  bool flight =
+      options.flight_recorder && flight_recorder::instance().open(options);
+  if (flight) {
+    install_signal_handlers();
+  } else {
+    flight_recorder::instance().close();
+  }
 
   auto logger = create_logger(options);
   logger->set_level((spdlog::level::level_enum)options.log_level);
 
+  // easylog reads the logger from its config; the registry's default logger
+  // is for spdlog's own API and isn't safe to replace while that is in use
   spdlog::set_level((spdlog::level::level_enum)options.log_level);
   spdlog::set_default_logger(logger);
+  config_domain::instance().update([&](log_config& config) {
+    config.logger = logger;
+    config.always_flush = options.always_flush;
+  });
+  {
+    auto& table = log_rules();
+    std::lock_guard<std::mutex> lock(table.mtx);
+    table.global_level = options.log_level;
+    table.flight_level = flight ? options.flight_recorder_level : OFF;
+    easylog::flight_active = flight;
+    apply_rules(table);
+  }
 
-  always_flush_ = options.always_flush;
   if (!options.always_flush && options.flush_interval > 0) {
     spdlog::flush_every(std::chrono::seconds(options.flush_interval));
   }
 
+  if (options.async) {
+    async_backend::instance().start(options);
+  } else {
+    async_backend::instance().disable();
+  }
 }
 
 void enable_always_flush(bool always_flush) {
-  always_flush_ = always_flush;
+  config_domain::instance().update(
+      [&](log_config& config) { config.always_flush = always_flush; });
+}
+
+void dump_flight_recorder() { flight_recorder::instance().dump(); }
+
+void flush_log() {
+  async_backend::instance().flush();
+  config_reader()->logger->flush();
 }
\ No newline at end of file
@@ -2,8 +2,16 @@
 #ifndef EASYLOG_H_
 #define EASYLOG_H_
 
-#include <sstream>
+#include <spdlog/fmt/fmt.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 
 constexpr int TRACE = 0;
 constexpr int DEBUG = 1;
@@ -13,6 +21,13 @@ constexpr int ERROR = 4;
 constexpr int CRITICAL = 5;
 constexpr int OFF = 6;
 
+// what LOG() does when its thread's async buffer is full
+enum class overflow_policy {
+  block,          // wait for the background thread to make room
+  drop_newest,    // drop the message
+  count_and_drop  // drop the message, the background thread reports the count
+};
+
 struct easylog_options {
   std::string id = "hachi";
   std::string app_log_name = "easylog";
@@ -22,6 +37,28 @@ struct easylog_options {
   int flush_interval = 3;
   int max_size = 1024 * 10; // 5 * 1024 * 1024
   int max_files = 5;
+  // LOG() copies the message into a per-thread ring buffer, one background
+  // thread formats it and writes the sinks
+  bool async = false;
+  int async_buffer_size = 1024 * 1024;  // bytes per thread
+  overflow_policy async_overflow = overflow_policy::block;
+  // write <app_log_name>.blog in the binary format below instead of the text
+  // log file, easylog_decoder turns it back into text
+  bool binary = false;
+  // write the text log file through spdlog's uring_file_sink: records are
+  // batched into large buffers, written with io_uring on Linux (fwrite
+  // elsewhere) and rotated on a background thread
+  bool uring_file = false;
+  // keep every message down to flight_recorder_level, whatever log_level
+  // says, in a per-thread ring of the memory mapped <app_log_name>.flight.
+  // The rings are dumped as text to <app_log_name>.flight.log on
+  // LOG(CRITICAL) and by dump_flight_recorder(), and copied as is to
+  // <app_log_name>.flight.crash on fatal signals; easylog_decoder reads that
+  // and the .flight file left by a killed process.
+  bool flight_recorder = false;
+  int flight_recorder_level = TRACE;
+  int flight_recorder_size = 256 * 1024;  // bytes per thread
+  int flight_recorder_threads = 64;
 };
 
 struct source_location {
@@ -49,23 +86,424 @@ struct source_location {
   const unsigned int line_;
 };
 
+namespace easylog {
+// messages below it are skipped before any formatting: the global level, the
+// lowest level of a log_rule or the flight recorder level
+inline std::atomic<int> min_level = TRACE;
+
+// lowest level written to the sinks, below it messages only go to the
+// flight recorder
+inline std::atomic<int> output_level = TRACE;
+inline std::atomic<bool> flight_active = false;
+
+// overrides the global level for a module, a file or one call site
+// a site rule wins over a file rule, which wins over a module rule; unset
+// fields keep the value of the wider rule
+struct log_rule {
+  int level = -1;              // -1: unset
+  uint32_t sample_one_in = 0;  // log 1 in N messages, 1 logs all, 0: unset
+  double rate_per_second = 0;  // token bucket refill rate, 0: unset
+  double burst = 1;            // token bucket size
+};
+
+void set_module_rule(std::string_view module_name, log_rule rule);
+
+// file is the base name, as printed in the log
+void set_file_rule(std::string_view file_name, log_rule rule);
+
+void set_site_rule(std::string_view file_name, unsigned line, log_rule rule);
+
+void clear_log_rules();
+
+// bumped by every rule change, call sites re-resolve their rule when they
+// see a new value
+inline std::atomic<uint64_t> rule_generation = 1;
+inline std::atomic<bool> rules_active = false;
+
+// the resolved rule of one call site, a function local static of LOG()/ELOG()
+class site_filter {
+ public:
+  constexpr site_filter() = default;
+
+  // id of the call site in the flight recorder file, with the file's epoch in
+  // the high 32 bits
+  uint64_t flight_id() const {
+    return flight_id_.load(std::memory_order_acquire);
+  }
+
+  void set_flight_id(uint64_t id) {
+    flight_id_.store(id, std::memory_order_release);
+  }
+
+  bool allow(int level, const char* module_name, const char* file_name,
+             unsigned line) {
+    uint64_t generation = rule_generation.load(std::memory_order_acquire);
+    if (generation_.load(std::memory_order_acquire) != generation)
+      resolve(generation, module_name, file_name, line);
+
+    if (level < level_.load(std::memory_order_relaxed))
+      return false;
+
+    uint32_t one_in = sample_one_in_.load(std::memory_order_relaxed);
+    if (one_in > 1 &&
+        count_.fetch_add(1, std::memory_order_relaxed) % one_in != 0) {
+      return false;
+    }
+
+    int64_t interval = interval_ns_.load(std::memory_order_relaxed);
+    return interval == 0 || take_token(interval);
+  }
+
+ private:
+  void resolve(uint64_t generation, const char* module_name,
+               const char* file_name, unsigned line);
+
+  // token bucket as a generic cell rate algorithm: a single "theoretical
+  // arrival time" advanced by one interval per message
+  bool take_token(int64_t interval);
+
+  std::atomic<uint64_t> generation_ = 0;
+  std::atomic<int> level_ = TRACE;
+  std::atomic<uint32_t> sample_one_in_ = 0;
+  std::atomic<uint32_t> count_ = 0;
+  std::atomic<int64_t> interval_ns_ = 0;
+  std::atomic<int64_t> tolerance_ns_ = 0;
+  std::atomic<int64_t> arrival_ns_ = 0;
+  std::atomic<uint64_t> flight_id_ = 0;
+};
+
+// one site_filter per file and line
+template <size_t N>
+struct source_file {
+  constexpr source_file(const char (&path)[N]) {
+    for (size_t i = 0; i < N; i++)
+      name[i] = path[i];
+  }
+
+  char name[N];
+};
+
+template <source_file File, unsigned Line>
+inline constinit site_filter site_filter_at{};
+
+// whether a message goes to the sinks
+inline bool should_output(int level, site_filter& filter,
+                          const char* module_name, const char* file_name,
+                          unsigned line) {
+  if (level < output_level.load(std::memory_order_relaxed))
+    return false;
+  if (!rules_active.load(std::memory_order_relaxed))
+    return true;
+  return filter.allow(level, module_name, file_name, line);
+}
+
+// whether a message goes to the sinks or the flight recorder
+inline bool should_log(int level, site_filter& filter, const char* module_name,
+                       const char* file_name, unsigned line) {
+  if (level < min_level.load(std::memory_order_relaxed))
+    return false;
+  if (flight_active.load(std::memory_order_relaxed))
+    return true;
+  return should_output(level, filter, module_name, file_name, line);
+}
+
+consteval const char* file_basename(const char* path) {
+  const char* name = path;
+  for (const char* p = path; *p; ++p) {
+    if (*p == '/' || *p == '\\')
+      name = p + 1;
+  }
+  return name;
+}
+
+// lets LOG() be `cond ? (void)0 : LogVoidify{} & stream << ...`
+struct LogVoidify {
+  void operator&(std::ostream&) {}
+};
+}  // namespace easylog
+
 struct LogMessage {
-  explicit LogMessage(int level, source_location location = {});
+  explicit LogMessage(int level, source_location location = {},
+                      easylog::site_filter* site = nullptr);
 
   ~LogMessage();
 
-  std::ostream& stream() { return os_; }
+  // a reused thread-local stream, no allocation per message
+  std::ostream& stream() { return *os_; }
 
  private:
   int level_;
   source_location location_;
-  std::ostringstream os_;
+  easylog::site_filter* site_;
+  std::ostream* os_;
+  size_t prefix_len_;
+  bool output_;
 };
 
-#define LOG(level) LogMessage{level}.stream()
+#define EASYLOG_SITE_FILTER() \
+  easylog::site_filter_at<easylog::source_file{__FILE__}, __LINE__>
+
+#define LOG(level)                                                     \
+  !easylog::should_log(level, EASYLOG_SITE_FILTER(), MODULE_NAME,      \
+                       easylog::file_basename(__FILE__), __LINE__)     \
+      ? (void)0                                                        \
+      : easylog::LogVoidify{} &                                        \
+            LogMessage{level,                                          \
+                       source_location{MODULE_NAME,                    \
+                                       easylog::file_basename(__FILE__)}, \
+                       &EASYLOG_SITE_FILTER()}                         \
+                .stream()
+
+namespace easylog {
+// how an ELOG() argument is packed into a record
+enum class arg_type : uint8_t {
+  none,
+  i64,
+  u64,
+  f32,
+  f64,
+  boolean,
+  character,
+  string,  // uint32_t length + bytes
+  pointer,
+};
+
+// static metadata of one ELOG() call site, records only carry a pointer to it
+// and their level, which may change from call to call
+struct log_site {
+  const char* module_name;
+  const char* file_name;
+  unsigned line;
+  std::string_view format;
+  const arg_type* arg_types;
+  size_t arg_count;
+  // formats the packed arguments of a record
+  void (*format_args)(fmt::memory_buffer& buf, std::string_view format,
+                      const char* data);
+};
+
+template <typename T>
+constexpr arg_type arg_type_of() {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same_v<U, bool>) {
+    return arg_type::boolean;
+  } else if constexpr (std::is_same_v<U, char>) {
+    return arg_type::character;
+  } else if constexpr (std::is_enum_v<U>) {
+    return arg_type_of<std::underlying_type_t<U>>();
+  } else if constexpr (std::is_integral_v<U>) {
+    return std::is_signed_v<U> ? arg_type::i64 : arg_type::u64;
+  } else if constexpr (std::is_same_v<U, float>) {
+    return arg_type::f32;
+  } else if constexpr (std::is_floating_point_v<U>) {
+    return arg_type::f64;
+  } else if constexpr (std::is_convertible_v<const U&, std::string_view>) {
+    return arg_type::string;
+  } else if constexpr (std::is_pointer_v<U>) {
+    return arg_type::pointer;
+  } else {
+    static_assert(!sizeof(U),
+                  "ELOG arguments must be arithmetic, string or pointer");
+  }
+}
+
+template <arg_type type>
+struct decoded;
+template <>
+struct decoded<arg_type::i64> {
+  using type = int64_t;
+};
+template <>
+struct decoded<arg_type::u64> {
+  using type = uint64_t;
+};
+template <>
+struct decoded<arg_type::f32> {
+  using type = float;
+};
+template <>
+struct decoded<arg_type::f64> {
+  using type = double;
+};
+template <>
+struct decoded<arg_type::boolean> {
+  using type = bool;
+};
+template <>
+struct decoded<arg_type::character> {
+  using type = char;
+};
+template <>
+struct decoded<arg_type::string> {
+  using type = std::string_view;
+};
+template <>
+struct decoded<arg_type::pointer> {
+  using type = const void*;
+};
+
+template <typename T>
+using decoded_t = typename decoded<arg_type_of<T>()>::type;
+
+template <typename T>
+size_t packed_size(const T& value) {
+  if constexpr (arg_type_of<T>() == arg_type::string) {
+    return sizeof(uint32_t) + std::string_view(value).size();
+  } else {
+    return sizeof(decoded_t<T>);
+  }
+}
+
+template <typename T>
+void pack(char*& data, const T& value) {
+  if constexpr (arg_type_of<T>() == arg_type::string) {
+    std::string_view str(value);
+    uint32_t len = (uint32_t)str.size();
+    memcpy(data, &len, sizeof(len));
+    memcpy(data + sizeof(len), str.data(), len);
+    data += sizeof(len) + len;
+  } else {
+    decoded_t<T> v = (decoded_t<T>)value;
+    memcpy(data, &v, sizeof(v));
+    data += sizeof(v);
+  }
+}
+
+template <typename T>
+decoded_t<T> unpack(const char*& data) {
+  if constexpr (arg_type_of<T>() == arg_type::string) {
+    uint32_t len;
+    memcpy(&len, data, sizeof(len));
+    std::string_view str(data + sizeof(len), len);
+    data += sizeof(len) + len;
+    return str;
+  } else {
+    decoded_t<T> v;
+    memcpy(&v, data, sizeof(v));
+    data += sizeof(v);
+    return v;
+  }
+}
+
+template <typename... Args>
+void format_packed(fmt::memory_buffer& buf, std::string_view format,
+                   const char* data) {
+  // braced initialization unpacks the arguments left to right
+  std::tuple<decoded_t<Args>...> values{unpack<Args>(data)...};
+  std::apply(
+      [&](auto&... v) {
+        fmt::format_to(std::back_inserter(buf), fmt::runtime(format), v...);
+      },
+      values);
+}
+
+// Binary log file: the magic, a uint32_t version and the int64_t time of the
+// first record in nanoseconds since the epoch, then entries starting with a tag byte. Integers are LEB128
+// varints, strings are a varint length + bytes.
+//   site:   varint id, uint8_t level, varint line, module, file, format,
+//           varint arg count, one arg_type byte per argument
+//   record: varint site id, varint zigzag time delta from the previous
+//           record in nanoseconds, varint size, packed arguments
+// A site is written before its first record in every file.
+namespace binary {
+constexpr char magic[8] = {'E', 'A', 'S', 'Y', 'L', 'O', 'G', 'B'};
+constexpr uint32_t version = 1;
+enum tag : uint8_t { site_tag = 'S', record_tag = 'R' };
+}  // namespace binary
+
+// true if ELOG() packs its arguments instead of formatting them in place,
+// either for the async backend or for the binary log file
+bool deferred_enabled();
+
+// space for the packed arguments, nullptr if the record was dropped
+char* reserve_record(const log_site& site, int level, size_t size);
+
+void commit_record(const log_site& site, int level, size_t size);
+
+void log_sync(const log_site& site, int level, fmt::format_args args);
+
+// space for the packed arguments in the calling thread's flight recorder
+// ring, nullptr if the record doesn't fit
+char* flight_reserve(site_filter& filter, const log_site& site, int level,
+                     size_t size);
+
+void flight_commit();
+
+// formats arguments packed as arg_types, used to decode records outside of
+// the process that wrote them; false if args is malformed
+bool format_packed_args(fmt::memory_buffer& buf, std::string_view format,
+                        const arg_type* arg_types, size_t arg_count,
+                        std::string_view args);
+
+// decodes a flight recorder file into text lines
+bool decode_flight_recorder(std::string_view file, fmt::memory_buffer& out);
+
+// the Tag is a lambda type unique to each ELOG() call site
+template <typename Tag, typename... Args>
+void deferred_log(Tag, int level, const char* module_name,
+                  const char* file_name, unsigned line,
+                  fmt::format_string<Args...> format, Args&&... args) {
+  static constexpr arg_type arg_types[] = {arg_type_of<Args>()...,
+                                           arg_type::none};
+  static const log_site site = [&] {
+    fmt::string_view str = format;
+    return log_site{module_name,
+                    file_name,
+                    line,
+                    std::string_view(str.data(), str.size()),
+                    arg_types,
+                    sizeof...(Args),
+                    &format_packed<Args...>};
+  }();
+  static site_filter filter;
+  if (flight_active.load(std::memory_order_relaxed)) {
+    size_t size = (packed_size(args) + ... + 0);
+    if (char* data = flight_reserve(filter, site, level, size)) {
+      (pack(data, args), ...);
+      flight_commit();
+    }
+    if (!should_output(level, filter, module_name, file_name, line))
+      return;
+  } else if (rules_active.load(std::memory_order_relaxed) &&
+             !filter.allow(level, module_name, file_name, line)) {
+    return;
+  }
+
+  if (!deferred_enabled()) {
+    log_sync(site, level, fmt::make_format_args(args...));
+    return;
+  }
+
+  size_t size = (packed_size(args) + ... + 0);
+  char* data = reserve_record(site, level, size);
+  if (data == nullptr)
+    return;
+
+  (pack(data, args), ...);
+  commit_record(site, level, size);
+}
+}  // namespace easylog
+
+// ELOG(INFO, "user {} took {} ms", id, ms): the format string is checked at
+// compile time; in async mode only the raw arguments are copied and the
+// background thread formats them
+#define ELOG(level, format, ...)                                         \
+  do {                                                                   \
+    if ((level) >= easylog::min_level.load(std::memory_order_relaxed)) { \
+      easylog::deferred_log([] {}, level, MODULE_NAME,                   \
+                            easylog::file_basename(__FILE__), __LINE__,  \
+                            format __VA_OPT__(, ) __VA_ARGS__);          \
+    }                                                                    \
+  } while (0)
 
 void init_log(easylog_options options = {}, bool over_write = false);
 
 void enable_always_flush(bool always_flush);
 
+// in async mode, wait until every buffered message is written, then flush
+void flush_log();
+
+// write the flight recorder rings to <app_log_name>.flight.log
+void dump_flight_recorder();
+
 #endif  // EASYLOG_H_
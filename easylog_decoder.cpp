@@ -0,0 +1,188 @@
+// Turns binary easylog files (easylog_options::binary) back into the text
+// layout of the rotating file sink:
+//   easylog_decoder easylog.2.blog easylog.1.blog easylog.blog > easylog.log
+// Flight recorder files (easylog_options::flight_recorder) are decoded too:
+//   easylog_decoder easylog.flight
+#include "easylog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+// same names as spdlog's %l
+constexpr std::string_view level_names[] = {
+    "trace", "debug", "info", "warning", "error", "critical", "off"};
+
+struct site {
+  int level = 0;
+  uint64_t line = 0;
+  std::string module_name;
+  std::string file_name;
+  std::string format;
+  std::vector<easylog::arg_type> arg_types;
+  bool defined = false;
+};
+
+class reader {
+ public:
+  explicit reader(std::string_view data) : data_(data) {}
+
+  bool at_end() const { return pos_ == data_.size(); }
+
+  uint8_t byte() { return (uint8_t)bytes(1)[0]; }
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t b = byte();
+      value |= uint64_t(b & 0x7f) << shift;
+      if ((b & 0x80) == 0)
+        return value;
+    }
+    throw std::runtime_error("bad varint");
+  }
+
+  std::string_view string() { return bytes(varint()); }
+
+  template <typename T>
+  T fixed() {
+    T value;
+    memcpy(&value, bytes(sizeof(T)).data(), sizeof(T));
+    return value;
+  }
+
+  std::string_view bytes(size_t n) {
+    if (data_.size() - pos_ < n)
+      throw std::runtime_error("truncated file");
+    auto str = data_.substr(pos_, n);
+    pos_ += n;
+    return str;
+  }
+
+ private:
+  std::string_view data_;
+  size_t pos_ = 0;
+};
+
+void format_time(fmt::memory_buffer& out, int64_t ns) {
+  time_t secs = (time_t)(ns / 1000000000);
+  int ms = (int)(ns % 1000000000 / 1000000);
+  std::tm tm{};
+#ifdef _WIN32
+  localtime_s(&tm, &secs);
+#else
+  localtime_r(&secs, &tm);
+#endif
+  fmt::format_to(std::back_inserter(out),
+                 "[{:02}-{:02} {:02}:{:02}:{:02}.{:03}]", tm.tm_mon + 1,
+                 tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, ms);
+}
+
+void format_message(fmt::memory_buffer& out, const site& s,
+                    std::string_view args) {
+  if (!easylog::format_packed_args(out, s.format, s.arg_types.data(),
+                                   s.arg_types.size(), args)) {
+    throw std::runtime_error("bad arguments");
+  }
+}
+
+void decode(std::string_view data, FILE* out) {
+  reader in(data);
+  std::vector<site> sites;
+  int64_t time = 0;
+  fmt::memory_buffer line;
+
+  while (!in.at_end()) {
+    uint8_t tag = in.byte();
+    if (tag == (uint8_t)easylog::binary::magic[0]) {
+      auto magic = in.bytes(sizeof(easylog::binary::magic) - 1);
+      if (magic != std::string_view(easylog::binary::magic + 1,
+                                    sizeof(easylog::binary::magic) - 1)) {
+        throw std::runtime_error("not an easylog binary file");
+      }
+      if (in.fixed<uint32_t>() != easylog::binary::version)
+        throw std::runtime_error("unsupported version");
+      time = in.fixed<int64_t>();
+      sites.clear();
+    } else if (tag == easylog::binary::site_tag) {
+      uint64_t id = in.varint();
+      if (id >= sites.size())
+        sites.resize(id + 1);
+      auto& s = sites[id];
+      s.level = in.byte();
+      s.line = in.varint();
+      s.module_name = in.string();
+      s.file_name = in.string();
+      s.format = in.string();
+      s.arg_types.clear();
+      for (uint64_t n = in.varint(); n > 0; n--) {
+        s.arg_types.push_back((easylog::arg_type)in.byte());
+      }
+      s.defined = true;
+    } else if (tag == easylog::binary::record_tag) {
+      uint64_t id = in.varint();
+      uint64_t zigzag = in.varint();
+      time += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+      auto args = in.string();
+      if (id >= sites.size() || !sites[id].defined)
+        throw std::runtime_error("record of an unknown site");
+
+      auto& s = sites[id];
+      line.clear();
+      format_time(line, time);
+      fmt::format_to(std::back_inserter(line), "[{}] [{}] {}:{}: ",
+                     level_names[std::min(s.level, OFF)], s.module_name,
+                     s.file_name, s.line);
+      format_message(line, s, args);
+      line.push_back('\n');
+      fwrite(line.data(), 1, line.size(), out);
+    } else {
+      throw std::runtime_error("bad entry");
+    }
+  }
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file.blog|file.flight...\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    std::ifstream file(argv[i], std::ios::binary);
+    if (!file) {
+      fprintf(stderr, "%s: can't open %s\n", argv[0], argv[i]);
+      return 1;
+    }
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string data = ss.str();
+    if (data.starts_with("EASYLOGF")) {
+      fmt::memory_buffer out;
+      if (!easylog::decode_flight_recorder(data, out)) {
+        fprintf(stderr, "%s: %s: bad flight recorder file\n", argv[0],
+                argv[i]);
+        return 1;
+      }
+      fwrite(out.data(), 1, out.size(), stdout);
+      continue;
+    }
+
+    try {
+      decode(data, stdout);
+    } catch (const std::exception& e) {
+      fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], e.what());
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -80,6 +80,15 @@ inline void init_thread_pool(
     details::registry::instance().set_tp(std::move(tp));
 }
 
+// set global thread pool with the given queue type, async_queue_type::lock_free
+// avoids the queue mutex when many threads log at once.
+inline void init_thread_pool(size_t q_size, size_t thread_count, async_queue_type queue_type,
+    std::function<void()> on_thread_start = [] {}, std::function<void()> on_thread_stop = [] {})
+{
+    auto tp = std::make_shared<details::thread_pool>(q_size, thread_count, queue_type, on_thread_start, on_thread_stop);
+    details::registry::instance().set_tp(std::move(tp));
+}
+
 inline void init_thread_pool(size_t q_size, size_t thread_count, std::function<void()> on_thread_start)
 {
     init_thread_pool(q_size, thread_count, on_thread_start, [] {});
@@ -0,0 +1,222 @@
+// Copyright(c) 2015-present, Gabi Melman & spdlog contributors.
+// Distributed under the MIT License (http://opensource.org/licenses/MIT)
+
+#pragma once
+
+// bounded lock-free multi producer-multi consumer queue (Dmitry Vyukov's
+// algorithm: every cell carries a sequence number telling whether it is ready
+// for the next producer or the next consumer).
+// Same interface as mpmc_blocking_queue:
+// enqueue(..) - will spin/yield until room found to put the new message.
+// enqueue_nowait(..) - will discard the oldest message if no room left.
+// dequeue_for(..) - will spin for a while, then park until an item arrives or
+// timeout have passed. producers only touch the mutex when a consumer is
+// parked.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace spdlog {
+namespace details {
+
+template<typename T>
+class mpmc_lockfree_queue
+{
+public:
+    using item_type = T;
+
+    explicit mpmc_lockfree_queue(size_t max_items)
+    {
+        size_t capacity = 2;
+        while (capacity < max_items)
+        {
+            capacity <<= 1;
+        }
+        mask_ = capacity - 1;
+        cells_.reset(new cell[capacity]);
+        for (size_t i = 0; i < capacity; i++)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_lockfree_queue(const mpmc_lockfree_queue &) = delete;
+    mpmc_lockfree_queue &operator=(const mpmc_lockfree_queue &) = delete;
+
+    // try to enqueue and spin/yield if no room left
+    void enqueue(T &&item)
+    {
+        for (unsigned spins = 0; !try_enqueue_(item); spins++)
+        {
+            backoff_(spins);
+        }
+        wake_consumer_();
+    }
+
+    // enqueue immediately. overrun oldest message in the queue if no room left.
+    void enqueue_nowait(T &&item)
+    {
+        while (!try_enqueue_(item))
+        {
+            T discarded;
+            if (try_dequeue_(discarded))
+            {
+                overrun_counter_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        wake_consumer_();
+    }
+
+    // try to dequeue item. if no item found. wait up to timeout and try again
+    // Return true, if succeeded dequeue item, false otherwise
+    bool dequeue_for(T &popped_item, std::chrono::milliseconds wait_duration)
+    {
+        for (unsigned spins = 0; spins < max_spins; spins++)
+        {
+            if (try_dequeue_(popped_item))
+            {
+                return true;
+            }
+            backoff_(spins);
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex_);
+        sleepers_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool dequeued = park_cv_.wait_for(lock, wait_duration, [&] { return try_dequeue_(popped_item); });
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return dequeued;
+    }
+
+    size_t overrun_counter()
+    {
+        return overrun_counter_.load(std::memory_order_relaxed);
+    }
+
+    size_t size()
+    {
+        size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    void reset_overrun_counter()
+    {
+        overrun_counter_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr unsigned max_spins = 256;
+    static constexpr size_t cacheline_size = 64;
+
+    struct cell
+    {
+        std::atomic<size_t> sequence{0};
+        T data;
+    };
+
+    bool try_enqueue_(T &item)
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        cell *c;
+        for (;;)
+        {
+            c = &cells_[pos & mask_];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        c->data = std::move(item);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_dequeue_(T &item)
+    {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        cell *c;
+        for (;;)
+        {
+            c = &cells_[pos & mask_];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        item = std::move(c->data);
+        c->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    void wake_consumer_()
+    {
+        // pairs with the fence in dequeue_for(): either the consumer sees the
+        // new item before parking, or we see it parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+            park_cv_.notify_one();
+        }
+    }
+
+    static void backoff_(unsigned spins)
+    {
+        if (spins < 16)
+        {
+            return;
+        }
+        if (spins < max_spins)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    std::unique_ptr<cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(cacheline_size) std::atomic<size_t> enqueue_pos_{0};
+    alignas(cacheline_size) std::atomic<size_t> dequeue_pos_{0};
+    alignas(cacheline_size) std::atomic<size_t> overrun_counter_{0};
+    std::atomic<int> sleepers_{0};
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+};
+} // namespace details
+} // namespace spdlog
@@ -13,10 +13,18 @@
 namespace spdlog {
 namespace details {
 
-SPDLOG_INLINE thread_pool::thread_pool(
-    size_t q_max_items, size_t threads_n, std::function<void()> on_thread_start, std::function<void()> on_thread_stop)
-    : q_(q_max_items)
+SPDLOG_INLINE thread_pool::thread_pool(size_t q_max_items, size_t threads_n, async_queue_type queue_type,
+    std::function<void()> on_thread_start, std::function<void()> on_thread_stop)
 {
+    if (queue_type == async_queue_type::lock_free)
+    {
+        lockfree_q_.reset(new lockfree_q_type(q_max_items));
+    }
+    else
+    {
+        q_.reset(new q_type(q_max_items));
+    }
+
     if (threads_n == 0 || threads_n > 1000)
     {
         throw_spdlog_ex("spdlog::thread_pool(): invalid threads_n param (valid "
@@ -32,6 +40,16 @@ SPDLOG_INLINE thread_pool::thread_pool(
     }
 }
 
+SPDLOG_INLINE thread_pool::thread_pool(size_t q_max_items, size_t threads_n, async_queue_type queue_type)
+    : thread_pool(
+          q_max_items, threads_n, queue_type, [] {}, [] {})
+{}
+
+SPDLOG_INLINE thread_pool::thread_pool(
+    size_t q_max_items, size_t threads_n, std::function<void()> on_thread_start, std::function<void()> on_thread_stop)
+    : thread_pool(q_max_items, threads_n, async_queue_type::blocking, on_thread_start, on_thread_stop)
+{}
+
 SPDLOG_INLINE thread_pool::thread_pool(size_t q_max_items, size_t threads_n, std::function<void()> on_thread_start)
     : thread_pool(q_max_items, threads_n, on_thread_start, [] {})
 {}
@@ -72,28 +90,53 @@ void SPDLOG_INLINE thread_pool::post_flush(async_logger_ptr &&worker_ptr, async_
 
 size_t SPDLOG_INLINE thread_pool::overrun_counter()
 {
-    return q_.overrun_counter();
+    return lockfree_q_ ? lockfree_q_->overrun_counter() : q_->overrun_counter();
 }
 
 void SPDLOG_INLINE thread_pool::reset_overrun_counter()
 {
-    q_.reset_overrun_counter();
+    if (lockfree_q_)
+    {
+        lockfree_q_->reset_overrun_counter();
+    }
+    else
+    {
+        q_->reset_overrun_counter();
+    }
 }
 
 size_t SPDLOG_INLINE thread_pool::queue_size()
 {
-    return q_.size();
+    return lockfree_q_ ? lockfree_q_->size() : q_->size();
+}
+
+async_queue_type SPDLOG_INLINE thread_pool::queue_type() const
+{
+    return lockfree_q_ ? async_queue_type::lock_free : async_queue_type::blocking;
 }
 
 void SPDLOG_INLINE thread_pool::post_async_msg_(async_msg &&new_msg, async_overflow_policy overflow_policy)
 {
+    if (lockfree_q_)
+    {
+        if (overflow_policy == async_overflow_policy::block)
+        {
+            lockfree_q_->enqueue(std::move(new_msg));
+        }
+        else
+        {
+            lockfree_q_->enqueue_nowait(std::move(new_msg));
+        }
+        return;
+    }
+
     if (overflow_policy == async_overflow_policy::block)
     {
-        q_.enqueue(std::move(new_msg));
+        q_->enqueue(std::move(new_msg));
     }
     else
     {
-        q_.enqueue_nowait(std::move(new_msg));
+        q_->enqueue_nowait(std::move(new_msg));
     }
 }
 
@@ -108,7 +151,8 @@ void SPDLOG_INLINE thread_pool::worker_loop_()
 bool SPDLOG_INLINE thread_pool::process_next_msg_()
 {
     async_msg incoming_async_msg;
-    bool dequeued = q_.dequeue_for(incoming_async_msg, std::chrono::seconds(10));
+    bool dequeued = lockfree_q_ ? lockfree_q_->dequeue_for(incoming_async_msg, std::chrono::seconds(10))
+                                : q_->dequeue_for(incoming_async_msg, std::chrono::seconds(10));
     if (!dequeued)
     {
         return true;
@@ -5,6 +5,7 @@
 
 #include <spdlog/details/log_msg_buffer.h>
 #include <spdlog/details/mpmc_blocking_q.h>
+#include <spdlog/details/mpmc_lockfree_q.h>
 #include <spdlog/details/os.h>
 
 #include <chrono>
@@ -16,6 +17,13 @@
 namespace spdlog {
 class async_logger;
 
+// queue between the loggers and the thread pool workers
+enum class async_queue_type
+{
+    blocking, // circular_q guarded by a mutex and two condition variables
+    lock_free // bounded lock-free ring, workers spin then park when idle
+};
+
 namespace details {
 
 using async_logger_ptr = std::shared_ptr<spdlog::async_logger>;
@@ -83,7 +91,11 @@ class SPDLOG_API thread_pool
 public:
     using item_type = async_msg;
     using q_type = details::mpmc_blocking_queue<item_type>;
+    using lockfree_q_type = details::mpmc_lockfree_queue<item_type>;
 
+    thread_pool(size_t q_max_items, size_t threads_n, async_queue_type queue_type, std::function<void()> on_thread_start,
+        std::function<void()> on_thread_stop);
+    thread_pool(size_t q_max_items, size_t threads_n, async_queue_type queue_type);
     thread_pool(size_t q_max_items, size_t threads_n, std::function<void()> on_thread_start, std::function<void()> on_thread_stop);
     thread_pool(size_t q_max_items, size_t threads_n, std::function<void()> on_thread_start);
     thread_pool(size_t q_max_items, size_t threads_n);
@@ -99,9 +111,12 @@ public:
     size_t overrun_counter();
     void reset_overrun_counter();
     size_t queue_size();
+    async_queue_type queue_type() const;
 
 private:
-    q_type q_;
+    // exactly one of them is created
+    std::unique_ptr<q_type> q_;
+    std::unique_ptr<lockfree_q_type> lockfree_q_;
 
     std::vector<std::thread> threads_;
 
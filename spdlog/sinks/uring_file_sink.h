@@ -0,0 +1,581 @@
+// Copyright(c) 2015-present, Gabi Melman & spdlog contributors.
+// Distributed under the MIT License (http://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/details/file_helper.h>
+#include <spdlog/details/null_mutex.h>
+#include <spdlog/details/os.h>
+#include <spdlog/details/synchronous_factory.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#    include <cerrno>
+#endif
+
+namespace spdlog {
+namespace details {
+
+#ifdef __linux__
+// Minimal io_uring for sequential writes, talks to the kernel directly so no
+// liburing is needed. init() fails on kernels or sandboxes without io_uring.
+class uring_writer
+{
+public:
+    uring_writer() = default;
+    uring_writer(const uring_writer &) = delete;
+    uring_writer &operator=(const uring_writer &) = delete;
+
+    ~uring_writer()
+    {
+        if (sqes_ != nullptr)
+        {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_)
+        {
+            ::munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != nullptr)
+        {
+            ::munmap(sq_ptr_, sq_size_);
+        }
+        if (ring_fd_ >= 0)
+        {
+            ::close(ring_fd_);
+        }
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = (int)::syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd_ < 0)
+        {
+            return false;
+        }
+
+        entries_ = params.sq_entries;
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+        {
+            sq_size_ = cq_size_ = (std::max)(sq_size_, cq_size_);
+        }
+
+        sq_ptr_ = map_(sq_size_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == nullptr)
+        {
+            return false;
+        }
+        cq_ptr_ = single_mmap ? sq_ptr_ : map_(cq_size_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == nullptr)
+        {
+            return false;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe *>(map_(sqes_size_, IORING_OFF_SQES));
+        if (sqes_ == nullptr)
+        {
+            return false;
+        }
+
+        auto sq = static_cast<char *>(sq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        auto cq = static_cast<char *>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    unsigned entries() const
+    {
+        return entries_;
+    }
+
+    // queue a write at the current file position. linked writes run one after
+    // the other, a failed or short write cancels the rest of the chain.
+    void prep_write(int fd, const char *data, size_t size, uint64_t user_data, bool link)
+    {
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        io_uring_sqe *sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(data);
+        sqe->len = static_cast<uint32_t>(size);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->flags = link ? IOSQE_IO_LINK : 0;
+        sqe->user_data = user_data;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        to_submit_++;
+    }
+
+    // submit the queued writes and wait for count completions
+    template<typename Handler>
+    bool submit_and_wait(unsigned count, Handler &&on_complete)
+    {
+        while (count > 0)
+        {
+            int ret = (int)::syscall(__NR_io_uring_enter, ring_fd_, to_submit_, count, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            to_submit_ -= (std::min)(to_submit_, static_cast<unsigned>(ret));
+
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail && count > 0; head++, count--)
+            {
+                io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+                on_complete(cqe->user_data, cqe->res);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+private:
+    void *map_(size_t size, off_t offset)
+    {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int ring_fd_ = -1;
+    unsigned entries_ = 0;
+    unsigned to_submit_ = 0;
+    void *sq_ptr_ = nullptr;
+    size_t sq_size_ = 0;
+    void *cq_ptr_ = nullptr;
+    size_t cq_size_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned *sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+};
+#endif // __linux__
+
+} // namespace details
+
+namespace sinks {
+
+//
+// Rotating file sink that formats into large page aligned buffers on the
+// logging thread and leaves writing and rotation to a background thread.
+// On Linux full buffers are submitted as linked io_uring writes, elsewhere or
+// when io_uring is unavailable they are written with fwrite.
+// Rotation follows rotating_file_sink: log.txt -> log.1.txt ... and happens
+// when the next message would exceed max_size.
+//
+template<typename Mutex>
+class uring_file_sink final : public base_sink<Mutex>
+{
+public:
+    uring_file_sink(filename_t base_filename, std::size_t max_size, std::size_t max_files, std::size_t buffer_size = 1024 * 1024,
+        std::size_t buffer_count = 4)
+        : base_filename_(std::move(base_filename))
+        , max_size_(max_size)
+        , max_files_(max_files)
+        , buffer_size_(buffer_size)
+    {
+        if (max_size == 0)
+        {
+            throw_spdlog_ex("uring_file_sink constructor: max_size arg cannot be zero");
+        }
+        if (max_files > 200000)
+        {
+            throw_spdlog_ex("uring_file_sink constructor: max_files arg cannot exceed 200000");
+        }
+        if (buffer_size == 0 || buffer_count < 2)
+        {
+            throw_spdlog_ex("uring_file_sink constructor: need at least two non empty buffers");
+        }
+
+        open_();
+        current_size_ = details::os::filesize(fd_);
+
+        for (std::size_t i = 0; i < buffer_count; i++)
+        {
+            buffers_.emplace_back(new buffer(buffer_size_));
+            free_.push_back(buffers_.back().get());
+        }
+
+#ifdef __linux__
+        if (ring_.init(static_cast<unsigned>(buffer_count)))
+        {
+            use_uring_ = true;
+        }
+#endif
+        writer_ = std::thread([this] { write_loop_(); });
+    }
+
+    ~uring_file_sink() override
+    {
+        {
+            std::lock_guard<Mutex> lock(base_sink<Mutex>::mutex_);
+            seal_(false);
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            stop_ = true;
+        }
+        pending_cv_.notify_one();
+        writer_.join();
+        close_();
+    }
+
+    uring_file_sink(const uring_file_sink &) = delete;
+    uring_file_sink &operator=(const uring_file_sink &) = delete;
+
+    // true if writes go through io_uring, false if through fwrite
+    bool using_io_uring() const
+    {
+        return use_uring_;
+    }
+
+protected:
+    void sink_it_(const details::log_msg &msg) override
+    {
+        memory_buf_t formatted;
+        base_sink<Mutex>::formatter_->format(msg, formatted);
+
+        auto new_size = current_size_ + formatted.size();
+        if (new_size > max_size_ && current_size_ > 0)
+        {
+            // the writer rotates right after this buffer
+            seal_(true);
+            new_size = formatted.size();
+        }
+        current_size_ = new_size;
+
+        const char *data = formatted.data();
+        std::size_t left = formatted.size();
+        while (left > 0)
+        {
+            if (current_ == nullptr)
+            {
+                current_ = acquire_();
+            }
+            std::size_t n = (std::min)(left, buffer_size_ - current_->size);
+            std::memcpy(current_->data + current_->size, data, n);
+            current_->size += n;
+            data += n;
+            left -= n;
+            if (current_->size == buffer_size_)
+            {
+                seal_(false);
+            }
+        }
+    }
+
+    // wait until everything logged so far reached the file
+    void flush_() override
+    {
+        seal_(false);
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        auto target = sealed_;
+        free_cv_.wait(lock, [&] { return written_ >= target; });
+    }
+
+private:
+    static constexpr std::size_t buffer_alignment = 4096;
+
+    struct buffer
+    {
+        explicit buffer(std::size_t capacity)
+            : data(static_cast<char *>(::operator new(capacity, std::align_val_t(buffer_alignment))))
+        {}
+
+        ~buffer()
+        {
+            ::operator delete(data, std::align_val_t(buffer_alignment));
+        }
+
+        char *data;
+        std::size_t size = 0;
+        bool rotate_after = false;
+    };
+
+    buffer *acquire_()
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        free_cv_.wait(lock, [this] { return !free_.empty(); });
+        buffer *b = free_.back();
+        free_.pop_back();
+        b->size = 0;
+        b->rotate_after = false;
+        return b;
+    }
+
+    // hand the current buffer to the writer, called under the sink mutex
+    void seal_(bool rotate_after)
+    {
+        if (current_ == nullptr)
+        {
+            if (!rotate_after)
+            {
+                return;
+            }
+            current_ = acquire_();
+        }
+
+        current_->rotate_after = rotate_after;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            pending_.push_back(current_);
+            sealed_++;
+        }
+        current_ = nullptr;
+        pending_cv_.notify_one();
+    }
+
+    void write_loop_()
+    {
+        std::vector<buffer *> batch;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex_);
+                pending_cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+                if (pending_.empty())
+                {
+                    return;
+                }
+
+                // a batch ends with the buffer that triggers a rotation
+                batch.clear();
+                while (!pending_.empty() && (batch.empty() || !batch.back()->rotate_after))
+                {
+                    batch.push_back(pending_.front());
+                    pending_.pop_front();
+                }
+            }
+
+            if (fd_ != nullptr)
+            {
+                write_batch_(batch);
+            }
+            if (batch.back()->rotate_after)
+            {
+                SPDLOG_TRY
+                {
+                    rotate_();
+                }
+                SPDLOG_CATCH_STD
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex_);
+                for (auto b : batch)
+                {
+                    free_.push_back(b);
+                }
+                written_ += batch.size();
+            }
+            free_cv_.notify_all();
+        }
+    }
+
+    void write_batch_(const std::vector<buffer *> &batch)
+    {
+#ifdef __linux__
+        if (use_uring_)
+        {
+            int fd = ::fileno(fd_);
+            std::vector<std::size_t> done(batch.size(), 0);
+            for (std::size_t i = 0; i < batch.size(); i++)
+            {
+                ring_.prep_write(fd, batch[i]->data, batch[i]->size, i, i + 1 < batch.size());
+            }
+            ring_.submit_and_wait(static_cast<unsigned>(batch.size()), [&](uint64_t index, int res) {
+                if (res > 0)
+                {
+                    done[index] = static_cast<std::size_t>(res);
+                }
+            });
+
+            // short or canceled writes end the chain, finish them in order
+            for (std::size_t i = 0; i < batch.size(); i++)
+            {
+                write_fd_(fd, batch[i]->data + done[i], batch[i]->size - done[i]);
+            }
+            return;
+        }
+#endif
+        for (auto b : batch)
+        {
+            if (std::fwrite(b->data, 1, b->size, fd_) != b->size)
+            {
+                report_("failed writing to file " + details::os::filename_to_str(filename_), errno);
+            }
+        }
+        std::fflush(fd_);
+    }
+
+#ifdef __linux__
+    void write_fd_(int fd, const char *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                report_("failed writing to file " + details::os::filename_to_str(filename_), errno);
+                return;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+    }
+#endif
+
+    // Rotate files:
+    // log.txt -> log.1.txt
+    // log.1.txt -> log.2.txt
+    // log.2.txt -> log.3.txt
+    // log.3.txt -> delete
+    void rotate_()
+    {
+        close_();
+        for (auto i = max_files_; i > 0; --i)
+        {
+            filename_t src = rotating_name_(i - 1);
+            if (!details::os::path_exists(src))
+            {
+                continue;
+            }
+            filename_t target = rotating_name_(i);
+            (void)details::os::remove(target);
+            if (details::os::rename(src, target) != 0)
+            {
+                report_("failed renaming " + details::os::filename_to_str(src) + " to " + details::os::filename_to_str(target), errno);
+            }
+        }
+        open_();
+    }
+
+    filename_t rotating_name_(std::size_t index) const
+    {
+        if (index == 0u)
+        {
+            return base_filename_;
+        }
+
+        filename_t basename, ext;
+        std::tie(basename, ext) = details::file_helper::split_by_extension(base_filename_);
+        return fmt_lib::format(SPDLOG_FILENAME_T("{}.{}{}"), basename, index, ext);
+    }
+
+    void open_()
+    {
+        filename_ = base_filename_;
+        details::os::create_dir(details::os::dir_name(filename_));
+        if (details::os::fopen_s(&fd_, filename_, SPDLOG_FILENAME_T("ab")))
+        {
+            fd_ = nullptr;
+            throw_spdlog_ex("Failed opening file " + details::os::filename_to_str(filename_) + " for writing", errno);
+        }
+    }
+
+    void close_()
+    {
+        if (fd_ != nullptr)
+        {
+            std::fclose(fd_);
+            fd_ = nullptr;
+        }
+    }
+
+    // the writer thread can't throw, report like the default error handler
+    static void report_(const std::string &msg, int last_errno)
+    {
+        std::fprintf(stderr, "[*** LOG ERROR ***] uring_file_sink: %s: %s\n", msg.c_str(), std::strerror(last_errno));
+    }
+
+    filename_t base_filename_;
+    filename_t filename_;
+    std::size_t max_size_;
+    std::size_t max_files_;
+    std::size_t buffer_size_;
+    std::size_t current_size_ = 0;
+    std::FILE *fd_ = nullptr;
+    bool use_uring_ = false;
+#ifdef __linux__
+    details::uring_writer ring_;
+#endif
+
+    std::vector<std::unique_ptr<buffer>> buffers_;
+    buffer *current_ = nullptr; // being filled, guarded by the sink mutex
+
+    std::mutex queue_mutex_;
+    std::condition_variable pending_cv_;
+    std::condition_variable free_cv_;
+    std::vector<buffer *> free_;
+    std::deque<buffer *> pending_;
+    uint64_t sealed_ = 0;
+    uint64_t written_ = 0;
+    bool stop_ = false;
+    std::thread writer_;
+};
+
+using uring_file_sink_mt = uring_file_sink<std::mutex>;
+using uring_file_sink_st = uring_file_sink<details::null_mutex>;
+
+} // namespace sinks
+
+//
+// factory functions
+//
+
+template<typename Factory = spdlog::synchronous_factory>
+inline std::shared_ptr<logger> uring_logger_mt(
+    const std::string &logger_name, const filename_t &filename, size_t max_file_size, size_t max_files)
+{
+    return Factory::template create<sinks::uring_file_sink_mt>(logger_name, filename, max_file_size, max_files);
+}
+
+template<typename Factory = spdlog::synchronous_factory>
+inline std::shared_ptr<logger> uring_logger_st(
+    const std::string &logger_name, const filename_t &filename, size_t max_file_size, size_t max_files)
+{
+    return Factory::template create<sinks::uring_file_sink_st>(logger_name, filename, max_file_size, max_files);
+}
+} // namespace spdlog